@@ -0,0 +1,49 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include "Vec3.hpp"
+
+class AABB
+{
+public:
+	Vec3f bmin, bmax;                       /// lower and upper corners of the box
+	AABB() : bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max()) {}
+	AABB(const Vec3f &lower, const Vec3f &upper) : bmin(lower), bmax(upper) {}
+
+	void expand(const Vec3f &p)
+	{
+		bmin = Vec3f(std::min(bmin.x, p.x), std::min(bmin.y, p.y), std::min(bmin.z, p.z));
+		bmax = Vec3f(std::max(bmax.x, p.x), std::max(bmax.y, p.y), std::max(bmax.z, p.z));
+	}
+	void expand(const AABB &box) { expand(box.bmin); expand(box.bmax); }
+
+	Vec3f centroid() const { return (bmin + bmax) * 0.5f; }
+	bool valid() const { return bmin.x <= bmax.x && bmin.y <= bmax.y && bmin.z <= bmax.z; }
+
+	float surfaceArea() const
+	{
+		if (!valid()) return 0;
+		Vec3f d = bmax - bmin;
+		return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	int largestAxis() const
+	{
+		Vec3f d = bmax - bmin;
+		if (d.x > d.y && d.x > d.z) return 0;
+		return d.y > d.z ? 1 : 2;
+	}
+
+	// Slab test against a ray given by its origin and reciprocal direction. tentry is the
+	// distance at which the ray enters the box (may be negative if the origin is inside).
+	bool intersect(const Vec3f &rayorig, const Vec3f &invdir, const float &tmax, float &tentry) const
+	{
+		float tx0 = (bmin.x - rayorig.x) * invdir.x, tx1 = (bmax.x - rayorig.x) * invdir.x;
+		float ty0 = (bmin.y - rayorig.y) * invdir.y, ty1 = (bmax.y - rayorig.y) * invdir.y;
+		float tz0 = (bmin.z - rayorig.z) * invdir.z, tz1 = (bmax.z - rayorig.z) * invdir.z;
+		float tnear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+		float tfar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+		tentry = tnear;
+		return tnear <= tfar && tfar >= 0 && tnear < tmax;
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Vec3.hpp"
+#include "Camera.hpp"
+
+// Running sum of every sample traced for each pixel while the view stays still, so a
+// static camera keeps refining the image instead of redrawing the same frame. begin() is
+// called once per frame and starts over whenever the camera or scene has changed.
+//
+// With a threshold set, the buffer also estimates each pixel's error from the variance of
+// its samples' luminance and marks the pixel converged once the standard error of its
+// average falls below threshold times its brightness. Renderers stop sampling converged
+// pixels, so flat walls, which every sample agrees on, stop costing rays after a few
+// frames while edges and reflections keep refining.
+class AccumulationBuffer
+{
+public:
+	static const unsigned kMinSamples = 8;  /// samples before a pixel's variance is trusted
+	static const unsigned kMaxPasses = 4;   /// samples a pixel above the threshold may take per frame
+
+	const unsigned width, height;
+	const float threshold;                  /// relative error at which pixels converge, 0 samples every pixel every frame
+
+	AccumulationBuffer(unsigned width, unsigned height, float threshold = 0)
+		: width(width), height(height), threshold(threshold), sum(width * height), luminance(width * height),
+		samples(width * height, 0), converged(width * height, 0),
+		frames(0), camera(Vec3f(0), Vec3f(0), 0, width, height), sceneversion(0)
+	{
+	}
+
+	// Start a frame seen through view of the given scene version, returns how many frames
+	// have already been accumulated (0 after a reset). Not thread safe, call between frames.
+	unsigned begin(const Camera &view, unsigned version)
+	{
+		if (frames == 0 || !view.sameView(camera) || version != sceneversion) {
+			std::fill(sum.begin(), sum.end(), Vec3f(0));
+			std::fill(luminance.begin(), luminance.end(), Moments());
+			std::fill(samples.begin(), samples.end(), 0u);
+			std::fill(converged.begin(), converged.end(), (unsigned char)0);
+			frames = 0;
+			camera = view;
+			sceneversion = version;
+		}
+		return frames++;
+	}
+
+	// Add a sample to a pixel and return the pixel's average. Tiles cover disjoint pixels,
+	// so this needs no locking.
+	Vec3f add(unsigned index, const Vec3f &sample)
+	{
+		sum[index] += sample;
+		unsigned n = ++samples[index];
+		if (threshold > 0) {
+			// Luminance is clamped to what the display shows, so overexposed pixels converge
+			float y = std::min(1.0f, 0.2126f * sample.x + 0.7152f * sample.y + 0.0722f * sample.z);
+			Moments &m = luminance[index];
+			m.sum += y, m.squares += y * y;
+			float mean = m.sum / n, variance = std::max(0.0f, m.squares / n - mean * mean);
+			converged[index] = n >= kMinSamples && std::sqrt(variance / n) <= threshold * std::max(mean, float(kDarkest));
+		}
+		return average(index);
+	}
+
+	Vec3f average(unsigned index) const { return sum[index] * (1.0f / std::max(1u, samples[index])); }
+	unsigned sampleCount(unsigned index) const { return samples[index]; }
+	bool isConverged(unsigned index) const { return converged[index] != 0; }
+
+	// Whether a pixel should be sampled again in the given pass of a frame. Every pixel
+	// takes one sample per frame until it converges, and with a threshold set, pixels whose
+	// error is known to be above it take up to kMaxPasses.
+	bool needsSample(unsigned index, unsigned pass) const
+	{
+		if (pass == 0) return !converged[index];
+		return threshold > 0 && pass < kMaxPasses && !converged[index] && samples[index] >= kMinSamples;
+	}
+
+	unsigned passes() const { return threshold > 0 ? kMaxPasses : 1; }
+
+	unsigned convergedCount() const { return (unsigned)std::count(converged.begin(), converged.end(), (unsigned char)1); }
+
+	// Sub-pixel offset for the given frame, from the Halton sequence in bases 2 and 3. The
+	// first frame samples the pixel corner, as an unaccumulated render does.
+	static void sampleOffset(unsigned frame, float &dx, float &dy)
+	{
+		dx = radicalInverse(frame, 2);
+		dy = radicalInverse(frame, 3);
+	}
+
+private:
+	static constexpr float kDarkest = 0.05f;    /// darker pixels converge at this brightness's error
+
+	struct Moments
+	{
+		float sum = 0, squares = 0;
+	};
+
+	std::vector<Vec3f> sum;
+	std::vector<Moments> luminance;         /// for the variance of each pixel's samples
+	std::vector<unsigned> samples;          /// samples summed for each pixel
+	std::vector<unsigned char> converged;
+	unsigned frames;                        /// frames accumulated since the last reset
+	Camera camera;                          /// view the sums were traced with
+	unsigned sceneversion;
+
+	static float radicalInverse(unsigned i, unsigned base)
+	{
+		float inverse = 1.0f / base, scale = inverse, result = 0;
+		for (; i > 0; i /= base, scale *= inverse)
+			result += (i % base) * scale;
+		return result;
+	}
+};
@@ -0,0 +1,181 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Vec3.hpp"
+#include "AABB.hpp"
+
+// Flattened bounding volume hierarchy node. Nodes are stored depth first, so the left
+// child of an interior node always directly follows it in the array.
+struct BVHNode
+{
+	AABB bounds;
+	unsigned offset;                        /// first primitive for leaves, right child index for interior nodes
+	unsigned count;                         /// number of primitives in a leaf (plus their BVH::kKindBits), 0 for interior nodes
+};
+
+// Surface area heuristic BVH builder. Primitives are referred to by index, and the top two
+// bits of an index (kKindBits) separate up to four kinds of primitive, e.g. spheres,
+// triangles and instances. Leaves never mix kinds, so a leaf's primitives can be stored
+// contiguously per kind.
+class BVH
+{
+public:
+	static const unsigned kBins = 16;              /// SAH candidate splits per axis
+	static const unsigned kMaxLeafPrimitives = 4;  /// leaves are split if they hold more than this
+	static const unsigned kMaxDepth = 64;          /// also the size of the traversal stacks
+	static const unsigned kKindBits = 0xC0000000u;
+
+	struct BuildPrimitive
+	{
+		AABB bounds;
+		Vec3f centroid;
+		unsigned index;
+	};
+
+	std::vector<BVHNode> nodes;
+	std::vector<unsigned> primitives;       /// primitive indices in leaf order, leaves index into this
+
+	// Build the hierarchy with the surface area heuristic, binning centroids along the
+	// largest axis of each node. Reorders build.
+	void build(std::vector<BuildPrimitive> &build)
+	{
+		nodes.clear();
+		primitives.clear();
+		if (build.empty()) return;
+
+		nodes.reserve(build.size() * 2);
+		primitives.reserve(build.size());
+		buildNode(build, 0, (unsigned)build.size(), 0);
+		nodes.shrink_to_fit();
+	}
+
+	static bool isLeaf(const BVHNode &node) { return node.count != 0; }
+	static unsigned leafCount(const BVHNode &node) { return node.count & ~kKindBits; }
+	static unsigned leafKind(const BVHNode &node) { return node.count & kKindBits; }
+
+private:
+	struct Bin
+	{
+		AABB bounds;
+		unsigned count = 0;
+	};
+
+	unsigned buildNode(std::vector<BuildPrimitive> &build, unsigned start, unsigned end, unsigned depth)
+	{
+		unsigned index = (unsigned)nodes.size();
+		nodes.push_back(BVHNode());
+
+		AABB bounds, centroidbounds;
+		for (unsigned i = start; i < end; ++i) {
+			bounds.expand(build[i].bounds);
+			centroidbounds.expand(build[i].centroid);
+		}
+		nodes[index].bounds = bounds;
+
+		unsigned count = end - start;
+		int axis = centroidbounds.largestAxis();
+		float cmin = centroidbounds.bmin[axis];
+		float extent = centroidbounds.bmax[axis] - cmin;
+
+		// Leave room for the levels below a forced leaf that separate mixed kinds
+		if (count == 1 || depth + 4 >= kMaxDepth || (extent <= 0 && count <= kMaxLeafPrimitives)) {
+			makeLeaf(build, index, start, end);
+			return index;
+		}
+
+		unsigned mid = start + count / 2;
+		if (extent > 0) {
+			// Bin the centroids and evaluate the SAH cost of every split between bins
+			Bin bins[kBins];
+			float scale = kBins / extent;
+			for (unsigned i = start; i < end; ++i) {
+				unsigned b = std::min(kBins - 1, (unsigned)((build[i].centroid[axis] - cmin) * scale));
+				bins[b].count++;
+				bins[b].bounds.expand(build[i].bounds);
+			}
+
+			float leftarea[kBins - 1];
+			unsigned leftcount[kBins - 1];
+			AABB accum;
+			unsigned accumcount = 0;
+			for (unsigned b = 0; b < kBins - 1; ++b) {
+				accum.expand(bins[b].bounds);
+				accumcount += bins[b].count;
+				leftarea[b] = accum.surfaceArea();
+				leftcount[b] = accumcount;
+			}
+
+			float bestcost = std::numeric_limits<float>::max();
+			unsigned bestsplit = 0;
+			accum = AABB();
+			accumcount = 0;
+			for (unsigned b = kBins - 1; b > 0; --b) {
+				accum.expand(bins[b].bounds);
+				accumcount += bins[b].count;
+				float cost = leftcount[b - 1] * leftarea[b - 1] + accumcount * accum.surfaceArea();
+				if (cost < bestcost) {
+					bestcost = cost;
+					bestsplit = b;
+				}
+			}
+
+			// Traversal and intersection are costed equally, relative to the parent's area
+			float area = bounds.surfaceArea();
+			bestcost = area > 0 ? 1 + bestcost / area : count;
+			if (bestcost >= count && count <= kMaxLeafPrimitives) {
+				makeLeaf(build, index, start, end);
+				return index;
+			}
+
+			BuildPrimitive* split = std::partition(build.data() + start, build.data() + end,
+				[&](const BuildPrimitive &p) {
+				return std::min(kBins - 1, (unsigned)((p.centroid[axis] - cmin) * scale)) < bestsplit;
+			});
+			mid = (unsigned)(split - build.data());
+		}
+
+		// Fall back to a median split if binning could not separate the primitives
+		if (mid == start || mid == end) {
+			mid = start + count / 2;
+			std::nth_element(build.data() + start, build.data() + mid, build.data() + end,
+				[&](const BuildPrimitive &a, const BuildPrimitive &b) { return a.centroid[axis] < b.centroid[axis]; });
+		}
+
+		buildNode(build, start, mid, depth + 1);
+		unsigned right = buildNode(build, mid, end, depth + 1);
+		nodes[index].offset = right;
+		nodes[index].count = 0;
+		return index;
+	}
+
+	void makeLeaf(std::vector<BuildPrimitive> &build, unsigned index, unsigned start, unsigned end)
+	{
+		// A leaf holding several kinds becomes an interior node over a leaf of the lowest kind
+		// and a node for the rest
+		unsigned lowest = kKindBits;
+		for (unsigned i = start; i < end; ++i) lowest = std::min(lowest, build[i].index & kKindBits);
+		BuildPrimitive* split = std::partition(build.data() + start, build.data() + end,
+			[&](const BuildPrimitive &p) { return (p.index & kKindBits) == lowest; });
+		unsigned mid = (unsigned)(split - build.data());
+		if (mid != start && mid != end) {
+			unsigned left = (unsigned)nodes.size();
+			nodes.push_back(BVHNode());
+			for (unsigned i = start; i < mid; ++i) nodes[left].bounds.expand(build[i].bounds);
+			makeLeaf(build, left, start, mid);
+			unsigned right = (unsigned)nodes.size();
+			nodes.push_back(BVHNode());
+			for (unsigned i = mid; i < end; ++i) nodes[right].bounds.expand(build[i].bounds);
+			makeLeaf(build, right, mid, end);
+			nodes[index].offset = right;
+			nodes[index].count = 0;
+			return;
+		}
+
+		nodes[index].offset = (unsigned)primitives.size();
+		nodes[index].count = (end - start) | (build[start].index & kKindBits);
+		for (unsigned i = start; i < end; ++i)
+			primitives.push_back(build[i].index);
+	}
+};
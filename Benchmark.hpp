@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "RayStats.hpp"
+
+// Timings and ray counts from rendering one benchmark scene
+struct BenchmarkResult
+{
+	std::string scene;
+	unsigned primitives = 0;
+	double seconds = 0;                     /// wall time for all frames
+	std::vector<double> frametimes;         /// milliseconds per frame
+	RayCounts rays = RayCounts();
+	unsigned refits = 0, rebuilds = 0;      /// BVH updates for animated instances
+
+	double raysPerSecond() const { return seconds > 0 ? rays.total() / seconds : 0; }
+
+	// Nearest rank percentile of the frame times, p from 0 to 100
+	double percentile(double p) const
+	{
+		if (frametimes.empty()) return 0;
+		std::vector<double> sorted(frametimes);
+		std::sort(sorted.begin(), sorted.end());
+		unsigned rank = (unsigned)std::ceil(p / 100 * sorted.size());
+		return sorted[std::min((unsigned)sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+};
+
+// Settings shared by every scene of a benchmark run
+struct BenchmarkSettings
+{
+	unsigned threads, width, height, frames, tileSize;
+	std::string kernels;                    /// SIMD kernel set in use
+	std::string scheduler;
+	bool packets;
+	bool wavefront;
+	bool sortRays;
+	unsigned maxDepth;
+	std::string pixelOrder;                 /// order pixels are traced in within a tile
+};
+
+// Write the results as JSON, returns false if the file could not be written
+inline bool writeBenchmarkJSON(const std::string &path, const BenchmarkSettings &settings,
+	const std::vector<BenchmarkResult> &results)
+{
+	std::ofstream file(path.c_str());
+	if (!file) return false;
+
+	file << "{\n";
+	file << "  \"threads\": " << settings.threads << ",\n";
+	file << "  \"width\": " << settings.width << ",\n";
+	file << "  \"height\": " << settings.height << ",\n";
+	file << "  \"frames\": " << settings.frames << ",\n";
+	file << "  \"tile_size\": " << settings.tileSize << ",\n";
+	file << "  \"kernels\": \"" << settings.kernels << "\",\n";
+	file << "  \"pixel_order\": \"" << settings.pixelOrder << "\",\n";
+	file << "  \"scheduler\": \"" << settings.scheduler << "\",\n";
+	file << "  \"packets\": " << (settings.packets ? "true" : "false") << ",\n";
+	file << "  \"wavefront\": " << (settings.wavefront ? "true" : "false") << ",\n";
+	file << "  \"sort_rays\": " << (settings.sortRays ? "true" : "false") << ",\n";
+	file << "  \"max_depth\": " << settings.maxDepth << ",\n";
+	file << "  \"scenes\": [";
+	for (unsigned i = 0; i < results.size(); ++i) {
+		const BenchmarkResult &result = results[i];
+		file << (i ? "," : "") << "\n    {\n";
+		file << "      \"name\": \"" << result.scene << "\",\n";
+		file << "      \"primitives\": " << result.primitives << ",\n";
+		file << "      \"seconds\": " << result.seconds << ",\n";
+		file << "      \"rays_per_second\": " << result.raysPerSecond() << ",\n";
+		file << "      \"ms_per_frame\": { \"p50\": " << result.percentile(50) << ", \"p90\": " << result.percentile(90)
+			<< ", \"p99\": " << result.percentile(99) << ", \"min\": " << result.percentile(0)
+			<< ", \"max\": " << result.percentile(100) << " },\n";
+		file << "      \"rays\": { ";
+		for (unsigned t = 0; t < kRayTypes; ++t)
+			file << "\"" << RayCounts::name(RayType(t)) << "\": " << result.rays.rays[t] << ", ";
+		file << "\"total\": " << result.rays.total() << " },\n";
+		file << "      \"intersection_tests\": " << result.rays.intersectionTests << ",\n";
+		file << "      \"node_visits\": " << result.rays.nodeVisits << ",\n";
+		file << "      \"secondary_packets\": " << result.rays.secondaryPackets << ",\n";
+		file << "      \"secondary_octants_per_packet\": " << result.rays.octantsPerPacket() << ",\n";
+		file << "      \"secondary_node_visits\": " << result.rays.secondaryVisits << ",\n";
+		file << "      \"bvh_refits\": " << result.refits << ",\n";
+		file << "      \"bvh_rebuilds\": " << result.rebuilds << "\n";
+		file << "    }";
+	}
+	file << "\n  ]\n}\n";
+	return bool(file);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cmath>
+#include "Vec3.hpp"
+
+#if !defined(M_PI)
+#define M_PI 3.141592653589793
+#endif
+
+// Where a scene file puts the camera, independent of the image size
+struct CameraPlacement
+{
+	Vec3f eye;
+	Vec3f tilt;
+	float fov;                              /// vertical field of view in degrees
+};
+
+// Pinhole camera looking down -z. Primary ray directions are offset by tilt, which angles
+// the view without rotating the image plane, and normalised again afterwards since the
+// intersection tests expect unit directions.
+class Camera
+{
+public:
+	Vec3f eye;
+	Vec3f tilt;
+	float fov;                              /// vertical field of view in degrees
+
+	Camera(const Vec3f &eye, const Vec3f &tilt, float fov, unsigned width, unsigned height)
+		: eye(eye), tilt(tilt), fov(fov)
+	{
+		invWidth = 1 / float(width), invHeight = 1 / float(height);
+		aspectratio = width / float(height);
+		angle = tan(M_PI * 0.5 * fov / 180.);
+	}
+
+	Camera(const CameraPlacement &placement, unsigned width, unsigned height)
+		: Camera(placement.eye, placement.tilt, placement.fov, width, height)
+	{
+	}
+
+	// Direction of the primary ray through image position (x, y), in pixels from the top
+	// left corner
+	Vec3f primaryRay(float x, float y) const
+	{
+		float xx = (2 * (x * invWidth) - 1) * angle * aspectratio;
+		float yy = (1 - 2 * (y * invHeight)) * angle;
+		Vec3f raydir(xx, yy, -1);
+		raydir.normalize();
+		raydir += tilt;
+		raydir.normalize();
+		return raydir;
+	}
+
+	// True if both cameras trace the same rays
+	bool sameView(const Camera &other) const
+	{
+		return eye.x == other.eye.x && eye.y == other.eye.y && eye.z == other.eye.z &&
+			tilt.x == other.tilt.x && tilt.y == other.tilt.y && tilt.z == other.tilt.z &&
+			fov == other.fov && invWidth == other.invWidth && invHeight == other.invHeight;
+	}
+
+private:
+	float invWidth, invHeight, aspectratio, angle;
+};
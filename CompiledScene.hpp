@@ -0,0 +1,722 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include <cmath>
+#include "Vec3.hpp"
+#include "AABB.hpp"
+#include "Material.hpp"
+#include "BVH.hpp"
+#include "Transform.hpp"
+#include "RayPacket.hpp"
+#include "SIMD.hpp"
+#include "RayStats.hpp"
+
+class SceneObject;
+class CompiledScene;
+
+// Placement of an instance, with the inverse used to take rays into its object space
+struct InstanceTransform
+{
+	Transform objectToWorld;
+	Transform worldToObject;
+};
+
+// The arrays read while rendering. They point either at the storage of a CompiledScene or
+// into a mapped scene cache (see SceneCache.hpp), which is used as is.
+struct CompiledArrays
+{
+	const float *sphereX, *sphereY, *sphereZ, *sphereRadius2;
+	const unsigned *sphereMaterial;
+
+	const float *triangleAX, *triangleAY, *triangleAZ;
+	const float *triangleABX, *triangleABY, *triangleABZ;
+	const float *triangleACX, *triangleACY, *triangleACZ;
+	const float *triangleNX, *triangleNY, *triangleNZ;     /// unit geometric normal, only read when shading
+	const unsigned *triangleMaterial;
+
+	const InstanceTransform* instanceTransforms;
+	const unsigned* instanceGeometry;       /// index into the scene's geometries
+
+	const Material* materials;
+	const BVHNode* nodes;
+
+	unsigned spheres, triangles, instances; /// primitive counts, the arrays also hold kPadding unused elements once built
+	unsigned materialCount, nodeCount;
+};
+
+// Render ready form of a scene. Spheres, triangles and instances are stored as separate
+// structure of arrays, ordered so every BVH leaf covers a contiguous range of one of them,
+// and surface properties are shared through an index into materials. Primitives are named
+// by their index in their own arrays, with kTriangleBit set for triangles and kInstanceBit
+// for instances.
+//
+// An instance places shared geometry, itself a CompiledScene of triangles with its own BVH,
+// and rays are moved into the geometry's object space to traverse it. A ray that hits an
+// instance reports kInstanceBit and the index of the triangle within the instance's geometry,
+// and which instance it was as a separate index, so every instance can hold as many
+// triangles as a scene can.
+class CompiledScene : public CompiledArrays
+{
+public:
+	static const unsigned kTriangleBit = 0x80000000u;
+	static const unsigned kInstanceBit = 0x40000000u;
+	static const unsigned kKindBits = BVH::kKindBits;
+	static const unsigned kPadding = 8;     /// unused elements after the last primitive, so kernels can load a full SIMD width
+
+	CompiledScene() { clear(); }
+
+	void clear()
+	{
+		storage = Storage();
+		materialIndex.clear();
+		geometries.clear();
+		geometryIndex.clear();
+		refitState = RefitState();
+		mapping.reset();
+		spheres = triangles = instances = 0;
+		point();
+	}
+
+	// Use arrays built earlier instead of adding primitives, such as ones mapped from a scene
+	// cache, along with the geometry their instances place. owner keeps the memory they
+	// point into alive for as long as they are used.
+	void attach(const CompiledArrays &arrays, const std::vector<std::shared_ptr<const CompiledScene>> &shared,
+		const std::shared_ptr<const void> &owner)
+	{
+		clear();
+		static_cast<CompiledArrays &>(*this) = arrays;
+		geometries = shared;
+		mapping = owner;
+	}
+
+	// Returns the index of a material with these properties, adding it if it is new
+	unsigned addMaterial(const Vec3f &surfaceColor, const Vec3f &emissionColor, float transparency, float reflection)
+	{
+		MaterialKey key = { { surfaceColor.x, surfaceColor.y, surfaceColor.z,
+			emissionColor.x, emissionColor.y, emissionColor.z, transparency, reflection } };
+		std::map<MaterialKey, unsigned>::const_iterator found = materialIndex.find(key);
+		if (found != materialIndex.end()) return found->second;
+
+		Material material;
+		material.surfaceColour = surfaceColor;
+		material.emissionColour = emissionColor;
+		material.transparency = transparency;
+		material.reflection = reflection;
+		storage.materials.push_back(material);
+		materialIndex[key] = (unsigned)storage.materials.size() - 1;
+		return (unsigned)storage.materials.size() - 1;
+	}
+
+	void addSphere(const Vec3f &center, float radius2, unsigned material, const SceneObject* source)
+	{
+		storage.sphereX.push_back(center.x), storage.sphereY.push_back(center.y), storage.sphereZ.push_back(center.z);
+		storage.sphereRadius2.push_back(radius2);
+		storage.sphereMaterial.push_back(material);
+		storage.sphereSource.push_back(source);
+		spheres++;
+	}
+
+	void addTriangle(const Vec3f &a, const Vec3f &b, const Vec3f &c, unsigned material, const SceneObject* source)
+	{
+		Vec3f ab = b - a, ac = c - a;
+		Vec3f normal = ab.crossProduct(ac).normalize();
+		storage.triangleAX.push_back(a.x), storage.triangleAY.push_back(a.y), storage.triangleAZ.push_back(a.z);
+		storage.triangleABX.push_back(ab.x), storage.triangleABY.push_back(ab.y), storage.triangleABZ.push_back(ab.z);
+		storage.triangleACX.push_back(ac.x), storage.triangleACY.push_back(ac.y), storage.triangleACZ.push_back(ac.z);
+		storage.triangleNX.push_back(normal.x), storage.triangleNY.push_back(normal.y), storage.triangleNZ.push_back(normal.z);
+		storage.triangleMaterial.push_back(material);
+		storage.triangleSource.push_back(source);
+		triangles++;
+	}
+
+	// Place geometry, a built scene of triangles only, which is shared rather than copied
+	void addInstance(const std::shared_ptr<const CompiledScene> &geometry, const Transform &objectToWorld, const SceneObject* source)
+	{
+		if (geometry->nodeCount == 0) return;
+		std::map<const CompiledScene*, unsigned>::const_iterator found = geometryIndex.find(geometry.get());
+		unsigned index = found != geometryIndex.end() ? found->second : (unsigned)geometries.size();
+		if (index == geometries.size()) {
+			geometries.push_back(geometry);
+			geometryIndex[geometry.get()] = index;
+		}
+		InstanceTransform transform = { objectToWorld, objectToWorld.inverse() };
+		storage.instanceTransforms.push_back(transform);
+		storage.instanceGeometry.push_back(index);
+		storage.instanceSource.push_back(source);
+		instances++;
+	}
+
+	// Build the BVH over every primitive added, then reorder the arrays into leaf order
+	void build()
+	{
+		point();
+		std::vector<BVH::BuildPrimitive> build;
+		build.reserve(spheres + triangles + instances);
+		for (unsigned i = 0; i < spheres; ++i) {
+			BVH::BuildPrimitive p;
+			p.bounds = sphereBounds(i);
+			p.centroid = p.bounds.centroid();
+			p.index = i;
+			build.push_back(p);
+		}
+		for (unsigned i = 0; i < triangles; ++i) {
+			BVH::BuildPrimitive p;
+			p.bounds = triangleBounds(i);
+			p.centroid = p.bounds.centroid();
+			p.index = i | kTriangleBit;
+			build.push_back(p);
+		}
+		for (unsigned i = 0; i < instances; ++i) {
+			BVH::BuildPrimitive p;
+			p.bounds = instanceBounds(i);
+			p.centroid = p.bounds.centroid();
+			p.index = i | kInstanceBit;
+			build.push_back(p);
+		}
+
+		BVH bvh;
+		bvh.build(build);
+		reorder(bvh);
+		storage.nodes.swap(bvh.nodes);
+		point();
+		prepareRefit();
+	}
+
+	// Place an instance somewhere else. The BVH is out of date until refit() or build().
+	void moveInstance(unsigned instance, const Transform &objectToWorld)
+	{
+		assert(!mapping && "attached arrays can't be changed");
+		InstanceTransform transform = { objectToWorld, objectToWorld.inverse() };
+		storage.instanceTransforms[instance] = transform;
+		refitState.moved.push_back(instance);
+	}
+
+	// Grow or shrink the bounds of every node above a moved instance to fit it again,
+	// bottom up, keeping the tree's structure. That only costs a few boxes per instance but
+	// the tree gets worse as instances drift from the ones they share nodes with, so this
+	// returns the SAH cost of the parts of the tree holding only instances relative to when
+	// it was built, for the caller to decide when a build() is worth it. The rest of the
+	// tree is left out since its large static primitives, such as the walls of the box,
+	// would hide any change.
+	float refit()
+	{
+		RefitState &r = refitState;
+		if (nodeCount == 0) return 1;
+		std::vector<unsigned> stale;
+		for (unsigned i = 0; i < r.moved.size(); ++i) {
+			for (unsigned n = r.instanceLeaves[r.moved[i]]; n != kNoParent && !r.stale[n]; n = r.parents[n]) {
+				r.stale[n] = 1;
+				stale.push_back(n);
+			}
+		}
+		r.moved.clear();
+
+		// Children come after their parent in the node array
+		std::sort(stale.begin(), stale.end(), std::greater<unsigned>());
+		for (unsigned i = 0; i < stale.size(); ++i) {
+			BVHNode &node = storage.nodes[stale[i]];
+			bool counted = r.instancesOnly[stale[i]] != 0;
+			if (counted) r.cost -= nodeCost(node);
+			node.bounds = AABB();
+			if (BVH::isLeaf(node)) {
+				for (unsigned p = node.offset; p < node.offset + BVH::leafCount(node); ++p)
+					node.bounds.expand(instanceBounds(p));
+			}
+			else {
+				node.bounds.expand(storage.nodes[stale[i] + 1].bounds);
+				node.bounds.expand(storage.nodes[node.offset].bounds);
+			}
+			if (counted) r.cost += nodeCost(node);
+			r.stale[stale[i]] = 0;
+		}
+		return r.builtCost > 0 ? float(r.cost / r.builtCost) : 1;
+	}
+
+	unsigned sphereCount() const { return spheres; }
+	unsigned triangleCount() const { return triangles; }
+	unsigned instanceCount() const { return instances; }
+	const std::vector<std::shared_ptr<const CompiledScene>> &sharedGeometry() const { return geometries; }
+	const CompiledScene &geometry(unsigned instance) const { return *geometries[instanceGeometry[instance]]; }
+
+	// Surface of a hit, instance hits use their geometry's material
+	const Material &material(unsigned primitive, unsigned instance) const
+	{
+		if (primitive & kInstanceBit) return geometry(instance).material((primitive & ~kKindBits) | kTriangleBit, 0);
+		unsigned i = primitive & ~kTriangleBit;
+		return materials[primitive & kTriangleBit ? triangleMaterial[i] : sphereMaterial[i]];
+	}
+
+	// Object a primitive (not a hit on an instance) came from, NULL for arrays from attach()
+	const SceneObject* source(unsigned primitive) const
+	{
+		unsigned i = primitive & ~kKindBits;
+		const std::vector<const SceneObject*> &sources = primitive & kTriangleBit ? storage.triangleSource :
+			primitive & kInstanceBit ? storage.instanceSource : storage.sphereSource;
+		return i < sources.size() ? sources[i] : NULL;
+	}
+
+	// World space geometric normal of a hit on an instance, not normalised
+	Vec3f instanceNormal(unsigned primitive, unsigned instance) const
+	{
+		Vec3f normal = geometry(instance).triangleNormal(primitive & ~kKindBits);
+		return instanceTransforms[instance].worldToObject.transposedVector(normal);
+	}
+
+	// Find the closest intersection along the ray. tnear is both the search limit on input
+	// and the distance to the hit on output. instance is only set for hits on an instance.
+	bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &tnear, unsigned &primitive, unsigned &instance) const
+	{
+		if (nodeCount == 0) return false;
+
+		const SimdKernels &kernels = simdKernels();
+		SphereArrays spherearrays = sphereArrays();
+		TriangleArrays trianglearrays = triangleArrays();
+		Vec3f invdir(1 / raydir.x, 1 / raydir.y, 1 / raydir.z);
+		float tentry;
+		if (!nodes[0].bounds.intersect(rayorig, invdir, tnear, tentry)) return false;
+
+		unsigned stack[BVH::kMaxDepth];
+		float stackt[BVH::kMaxDepth];
+		unsigned sp = 0;
+		unsigned current = 0;
+		unsigned hit = kNoHit, hitinstance = 0;
+		unsigned tests = 0, visits = 0;
+		while (true) {
+			const BVHNode &node = nodes[current];
+			visits++;
+			if (BVH::isLeaf(node)) {
+				unsigned leafhit = kNoHit;
+				tests += BVH::leafCount(node);
+				if (BVH::leafKind(node) == kTriangleBit) {
+					kernels.intersectTriangles(trianglearrays, node.offset, BVH::leafCount(node), rayorig, raydir, tnear, leafhit);
+					if (leafhit != kNoHit) hit = leafhit | kTriangleBit;
+				}
+				else if (BVH::leafKind(node) == kInstanceBit) {
+					for (unsigned i = node.offset; i < node.offset + BVH::leafCount(node); ++i)
+						if (intersectInstance(i, rayorig, raydir, tnear, leafhit)) hit = leafhit, hitinstance = i;
+				}
+				else {
+					kernels.intersectSpheres(spherearrays, node.offset, BVH::leafCount(node), rayorig, raydir, tnear, leafhit);
+					if (leafhit != kNoHit) hit = leafhit;
+				}
+			}
+			else {
+				// Visit the nearer child first and defer the other one
+				unsigned left = current + 1, right = node.offset;
+				float tleft, tright;
+				bool hitleft = nodes[left].bounds.intersect(rayorig, invdir, tnear, tleft);
+				bool hitright = nodes[right].bounds.intersect(rayorig, invdir, tnear, tright);
+				if (hitleft && hitright) {
+					if (tright < tleft) std::swap(left, right), std::swap(tleft, tright);
+					stack[sp] = right;
+					stackt[sp++] = tright;
+					current = left;
+					continue;
+				}
+				if (hitleft || hitright) {
+					current = hitleft ? left : right;
+					continue;
+				}
+			}
+
+			// Pop the next deferred node, skipping any that are now further than the closest hit
+			do {
+				if (sp == 0) {
+					RayStats::addTraversal(tests, visits);
+					if (hit == kNoHit) return false;
+					primitive = hit, instance = hitinstance;
+					return true;
+				}
+				current = stack[--sp];
+			} while (stackt[sp] >= tnear);
+		}
+	}
+
+	// Shadow ray query, stops at the first primitive hit closer than tmax. Children are
+	// visited in a fixed order since any hit will do.
+	bool occluded(const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const
+	{
+		if (nodeCount == 0) return false;
+
+		const SimdKernels &kernels = simdKernels();
+		Vec3f invdir(1 / raydir.x, 1 / raydir.y, 1 / raydir.z);
+		unsigned stack[BVH::kMaxDepth];
+		unsigned sp = 0;
+		unsigned current = 0;
+		unsigned tests = 0, visits = 0;
+		while (true) {
+			const BVHNode &node = nodes[current];
+			float tentry;
+			visits++;
+			if (node.bounds.intersect(rayorig, invdir, tmax, tentry)) {
+				if (!BVH::isLeaf(node)) {
+					stack[sp++] = node.offset;
+					current = current + 1;
+					continue;
+				}
+				tests += BVH::leafCount(node);
+				unsigned kind = BVH::leafKind(node);
+				if (kind == kTriangleBit ?
+					kernels.occludedTriangles(triangleArrays(), node.offset, BVH::leafCount(node), rayorig, raydir, tmax) :
+					kind == kInstanceBit ? occludedInstances(node.offset, BVH::leafCount(node), rayorig, raydir, tmax) :
+					kernels.occludedSpheres(sphereArrays(), node.offset, BVH::leafCount(node), rayorig, raydir, tmax)) {
+					RayStats::addTraversal(tests, visits);
+					return true;
+				}
+			}
+			if (sp == 0) {
+				RayStats::addTraversal(tests, visits);
+				return false;
+			}
+			current = stack[--sp];
+		}
+	}
+
+	// Closest hit for every active ray of a packet. A node is entered if any ray hits it, so
+	// this pays off when the rays are coherent, such as primary rays from one tile.
+	void intersectPacket(RayPacket &packet) const
+	{
+		if (nodeCount == 0 || !packet.active) return;
+
+		const SimdKernels &kernels = simdKernels();
+		float tentry;
+		if (!kernels.intersectBox(packet, packet.active, nodes[0].bounds, tentry)) return;
+
+		unsigned stack[BVH::kMaxDepth];
+		unsigned sp = 0;
+		unsigned current = 0;
+		unsigned tests = 0, visits = 0;
+		while (true) {
+			const BVHNode &node = nodes[current];
+			visits++;
+			if (BVH::isLeaf(node)) {
+				unsigned end = node.offset + BVH::leafCount(node);
+				tests += BVH::leafCount(node);
+				if (BVH::leafKind(node) == kTriangleBit) {
+					for (unsigned i = node.offset; i < end; ++i)
+						kernels.intersectTriangle(packet, triangleA(i), triangleAB(i), triangleAC(i), i | kTriangleBit);
+				}
+				else if (BVH::leafKind(node) == kInstanceBit) {
+					for (unsigned i = node.offset; i < end; ++i)
+						intersectInstancePacket(i, packet);
+				}
+				else {
+					for (unsigned i = node.offset; i < end; ++i)
+						kernels.intersectSphere(packet, sphereCenter(i), sphereRadius2[i], i);
+				}
+			}
+			else {
+				unsigned left = current + 1, right = node.offset;
+				float tleft, tright;
+				unsigned hitleft = kernels.intersectBox(packet, packet.active, nodes[left].bounds, tleft);
+				unsigned hitright = kernels.intersectBox(packet, packet.active, nodes[right].bounds, tright);
+				if (hitleft && hitright) {
+					if (tright < tleft) std::swap(left, right);
+					stack[sp++] = right;
+					current = left;
+					continue;
+				}
+				if (hitleft || hitright) {
+					current = hitleft ? left : right;
+					continue;
+				}
+			}
+
+			// Deferred nodes are tested again since the packet's hits may now be closer
+			do {
+				if (sp == 0) {
+					RayStats::addTraversal(tests, visits);
+					return;
+				}
+				current = stack[--sp];
+			} while (!kernels.intersectBox(packet, packet.active, nodes[current].bounds, tentry));
+		}
+	}
+
+	// Any-hit query for a packet of shadow rays, sets packet.occluded for each blocked ray and
+	// stops once every ray is blocked
+	void occludedPacket(RayPacket &packet) const
+	{
+		if (nodeCount == 0) return;
+
+		const SimdKernels &kernels = simdKernels();
+		unsigned stack[BVH::kMaxDepth];
+		unsigned sp = 0;
+		unsigned current = 0;
+		unsigned tests = 0, visits = 0;
+		while (true) {
+			unsigned lanes = packet.active & ~packet.occluded;
+			if (!lanes) break;
+			const BVHNode &node = nodes[current];
+			float tentry;
+			visits++;
+			if (kernels.intersectBox(packet, lanes, node.bounds, tentry)) {
+				if (!BVH::isLeaf(node)) {
+					stack[sp++] = node.offset;
+					current = current + 1;
+					continue;
+				}
+				unsigned end = node.offset + BVH::leafCount(node);
+				tests += BVH::leafCount(node);
+				if (BVH::leafKind(node) == kTriangleBit) {
+					for (unsigned i = node.offset; i < end; ++i)
+						kernels.occludedTriangle(packet, triangleA(i), triangleAB(i), triangleAC(i));
+				}
+				else if (BVH::leafKind(node) == kInstanceBit) {
+					for (unsigned i = node.offset; i < end; ++i)
+						occludedInstancePacket(i, packet);
+				}
+				else {
+					for (unsigned i = node.offset; i < end; ++i)
+						kernels.occludedSphere(packet, sphereCenter(i), sphereRadius2[i]);
+				}
+			}
+			if (sp == 0) break;
+			current = stack[--sp];
+		}
+		RayStats::addTraversal(tests, visits);
+	}
+
+	Vec3f sphereCenter(unsigned i) const { return Vec3f(sphereX[i], sphereY[i], sphereZ[i]); }
+	Vec3f triangleA(unsigned i) const { return Vec3f(triangleAX[i], triangleAY[i], triangleAZ[i]); }
+	Vec3f triangleAB(unsigned i) const { return Vec3f(triangleABX[i], triangleABY[i], triangleABZ[i]); }
+	Vec3f triangleAC(unsigned i) const { return Vec3f(triangleACX[i], triangleACY[i], triangleACZ[i]); }
+	Vec3f triangleNormal(unsigned i) const { return Vec3f(triangleNX[i], triangleNY[i], triangleNZ[i]); }
+
+private:
+	typedef std::array<float, 8> MaterialKey;
+
+	std::vector<std::shared_ptr<const CompiledScene>> geometries;  /// placed by the instances, shared with other scenes
+	std::map<const CompiledScene*, unsigned> geometryIndex;
+
+	static const unsigned kNoParent = 0xFFFFFFFFu;
+
+	// What refit() needs to find the nodes above an instance and to track the tree's quality
+	struct RefitState
+	{
+		std::vector<unsigned> parents;      /// of each node
+		std::vector<unsigned> instanceLeaves;   /// leaf holding each instance
+		std::vector<unsigned char> instancesOnly;   /// nodes with only instances below them
+		std::vector<unsigned char> stale;   /// nodes queued by the current refit
+		std::vector<unsigned> moved;        /// instances moved since the last refit
+		double cost = 0;                    /// sum of nodeCost() over the instancesOnly nodes
+		double builtCost = 0;               /// cost when built
+	};
+
+	RefitState refitState;
+
+	// Primitives added to this scene, which the CompiledArrays point at
+	struct Storage
+	{
+		std::vector<float> sphereX, sphereY, sphereZ, sphereRadius2;
+		std::vector<unsigned> sphereMaterial;
+		std::vector<const SceneObject*> sphereSource;   /// object each primitive came from, not used while traversing
+
+		std::vector<float> triangleAX, triangleAY, triangleAZ;
+		std::vector<float> triangleABX, triangleABY, triangleABZ;
+		std::vector<float> triangleACX, triangleACY, triangleACZ;
+		std::vector<float> triangleNX, triangleNY, triangleNZ;
+		std::vector<unsigned> triangleMaterial;
+		std::vector<const SceneObject*> triangleSource;
+
+		std::vector<InstanceTransform> instanceTransforms;
+		std::vector<unsigned> instanceGeometry;
+		std::vector<const SceneObject*> instanceSource;
+
+		std::vector<Material> materials;
+		std::vector<BVHNode> nodes;
+	};
+
+	Storage storage;
+	std::map<MaterialKey, unsigned> materialIndex;
+	std::shared_ptr<const void> mapping;    /// memory of attached arrays
+
+	// Point the arrays at the storage, again after anything that may reallocate it
+	void point()
+	{
+		sphereX = storage.sphereX.data(), sphereY = storage.sphereY.data(), sphereZ = storage.sphereZ.data();
+		sphereRadius2 = storage.sphereRadius2.data();
+		sphereMaterial = storage.sphereMaterial.data();
+		triangleAX = storage.triangleAX.data(), triangleAY = storage.triangleAY.data(), triangleAZ = storage.triangleAZ.data();
+		triangleABX = storage.triangleABX.data(), triangleABY = storage.triangleABY.data(), triangleABZ = storage.triangleABZ.data();
+		triangleACX = storage.triangleACX.data(), triangleACY = storage.triangleACY.data(), triangleACZ = storage.triangleACZ.data();
+		triangleNX = storage.triangleNX.data(), triangleNY = storage.triangleNY.data(), triangleNZ = storage.triangleNZ.data();
+		triangleMaterial = storage.triangleMaterial.data();
+		instanceTransforms = storage.instanceTransforms.data();
+		instanceGeometry = storage.instanceGeometry.data();
+		materials = storage.materials.data();
+		nodes = storage.nodes.data();
+		materialCount = (unsigned)storage.materials.size();
+		nodeCount = (unsigned)storage.nodes.size();
+	}
+
+	SphereArrays sphereArrays() const
+	{
+		SphereArrays arrays = { sphereX, sphereY, sphereZ, sphereRadius2 };
+		return arrays;
+	}
+
+	TriangleArrays triangleArrays() const
+	{
+		TriangleArrays arrays = { triangleAX, triangleAY, triangleAZ,
+			triangleABX, triangleABY, triangleABZ,
+			triangleACX, triangleACY, triangleACZ };
+		return arrays;
+	}
+
+	AABB sphereBounds(unsigned i) const
+	{
+		float radius = sqrt(sphereRadius2[i]);
+		return AABB(sphereCenter(i) - Vec3f(radius), sphereCenter(i) + Vec3f(radius));
+	}
+
+	AABB triangleBounds(unsigned i) const
+	{
+		AABB box;
+		box.expand(triangleA(i));
+		box.expand(triangleA(i) + triangleAB(i));
+		box.expand(triangleA(i) + triangleAC(i));
+		return box;
+	}
+
+	// Surface area heuristic cost of a node, before dividing by the surface area of the tree
+	static double nodeCost(const BVHNode &node)
+	{
+		return double(node.bounds.surfaceArea()) * (BVH::isLeaf(node) ? BVH::leafCount(node) : 1);
+	}
+
+	void prepareRefit()
+	{
+		RefitState &r = refitState;
+		r = RefitState();
+		r.parents.assign(nodeCount, unsigned(kNoParent));
+		r.instanceLeaves.assign(instances, 0);
+		r.instancesOnly.assign(nodeCount, 0);
+		r.stale.assign(nodeCount, 0);
+		for (unsigned n = nodeCount; n-- > 0;) {
+			const BVHNode &node = nodes[n];
+			if (!BVH::isLeaf(node)) {
+				r.parents[n + 1] = r.parents[node.offset] = n;
+				r.instancesOnly[n] = r.instancesOnly[n + 1] && r.instancesOnly[node.offset];
+			}
+			else if (BVH::leafKind(node) == kInstanceBit) {
+				for (unsigned i = node.offset; i < node.offset + BVH::leafCount(node); ++i)
+					r.instanceLeaves[i] = n;
+				r.instancesOnly[n] = 1;
+			}
+			if (r.instancesOnly[n]) r.cost += nodeCost(node);
+		}
+		r.builtCost = r.cost;
+	}
+
+	AABB instanceBounds(unsigned i) const
+	{
+		return instanceTransforms[i].objectToWorld.bounds(geometry(i).nodes[0].bounds);
+	}
+
+	// Rays are taken into the instance's object space without normalising the direction,
+	// so distances along them are the same in both spaces
+	bool intersectInstance(unsigned i, const Vec3f &rayorig, const Vec3f &raydir, float &tnear, unsigned &primitive) const
+	{
+		const Transform &toobject = instanceTransforms[i].worldToObject;
+		unsigned triangle, instance;
+		if (!geometry(i).intersect(toobject.point(rayorig), toobject.vector(raydir), tnear, triangle, instance)) return false;
+		primitive = kInstanceBit | (triangle & ~kTriangleBit);
+		return true;
+	}
+
+	bool occludedInstances(unsigned first, unsigned count, const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const
+	{
+		for (unsigned i = first; i < first + count; ++i) {
+			const Transform &toobject = instanceTransforms[i].worldToObject;
+			if (geometry(i).occluded(toobject.point(rayorig), toobject.vector(raydir), tmax)) return true;
+		}
+		return false;
+	}
+
+	// Traces the packet's active rays through one instance as a packet in its object space
+	void intersectInstancePacket(unsigned i, RayPacket &packet) const
+	{
+		const Transform &toobject = instanceTransforms[i].worldToObject;
+		RayPacket local;
+		for (unsigned lane = 0; lane < RayPacket::kSize; ++lane) {
+			if (packet.active & (1u << lane))
+				local.setRay(lane, toobject.point(packet.origin(lane)), toobject.vector(packet.direction(lane)), packet.tnear[lane]);
+		}
+		geometry(i).intersectPacket(local);
+		for (unsigned lane = 0; lane < RayPacket::kSize; ++lane) {
+			if (local.hit[lane] == kNoHit) continue;
+			packet.tnear[lane] = local.tnear[lane];
+			packet.hit[lane] = kInstanceBit | (local.hit[lane] & ~kTriangleBit);
+			packet.instance[lane] = i;
+		}
+	}
+
+	void occludedInstancePacket(unsigned i, RayPacket &packet) const
+	{
+		const Transform &toobject = instanceTransforms[i].worldToObject;
+		RayPacket local;
+		for (unsigned lane = 0; lane < RayPacket::kSize; ++lane) {
+			if ((packet.active & ~packet.occluded) & (1u << lane))
+				local.setRay(lane, toobject.point(packet.origin(lane)), toobject.vector(packet.direction(lane)), packet.tnear[lane]);
+		}
+		geometry(i).occludedPacket(local);
+		packet.occluded |= local.occluded;
+	}
+
+	template<typename T>
+	static void permute(std::vector<T> &values, const std::vector<unsigned> &order, const T &padding)
+	{
+		std::vector<T> reordered;
+		reordered.reserve(order.size() + kPadding);
+		for (unsigned i = 0; i < order.size(); ++i)
+			reordered.push_back(values[order[i]]);
+		reordered.resize(order.size() + kPadding, padding);
+		values.swap(reordered);
+	}
+
+	// Move the primitives of each leaf next to each other, in the order the leaves appear in
+	// the node array, and point the leaves at their new ranges
+	void reorder(BVH &bvh)
+	{
+		std::vector<unsigned> sphereorder, triangleorder, instanceorder;
+		sphereorder.reserve(spheres);
+		triangleorder.reserve(triangles);
+		instanceorder.reserve(instances);
+		for (unsigned n = 0; n < bvh.nodes.size(); ++n) {
+			BVHNode &node = bvh.nodes[n];
+			if (!BVH::isLeaf(node)) continue;
+			unsigned kind = BVH::leafKind(node);
+			std::vector<unsigned> &order = kind == kTriangleBit ? triangleorder : kind == kInstanceBit ? instanceorder : sphereorder;
+			unsigned first = (unsigned)order.size();
+			for (unsigned i = node.offset; i < node.offset + BVH::leafCount(node); ++i)
+				order.push_back(bvh.primitives[i] & ~kKindBits);
+			node.offset = first;
+		}
+
+		Storage &s = storage;
+		permute(s.sphereX, sphereorder, 0.0f), permute(s.sphereY, sphereorder, 0.0f), permute(s.sphereZ, sphereorder, 0.0f);
+		permute(s.sphereRadius2, sphereorder, 0.0f);
+		permute(s.sphereMaterial, sphereorder, 0u);
+		permute(s.sphereSource, sphereorder, (const SceneObject*)NULL);
+
+		permute(s.triangleAX, triangleorder, 0.0f), permute(s.triangleAY, triangleorder, 0.0f), permute(s.triangleAZ, triangleorder, 0.0f);
+		permute(s.triangleABX, triangleorder, 0.0f), permute(s.triangleABY, triangleorder, 0.0f), permute(s.triangleABZ, triangleorder, 0.0f);
+		permute(s.triangleACX, triangleorder, 0.0f), permute(s.triangleACY, triangleorder, 0.0f), permute(s.triangleACZ, triangleorder, 0.0f);
+		permute(s.triangleNX, triangleorder, 0.0f), permute(s.triangleNY, triangleorder, 0.0f), permute(s.triangleNZ, triangleorder, 0.0f);
+		permute(s.triangleMaterial, triangleorder, 0u);
+		permute(s.triangleSource, triangleorder, (const SceneObject*)NULL);
+
+		permute(s.instanceTransforms, instanceorder, InstanceTransform());
+		permute(s.instanceGeometry, instanceorder, 0u);
+		permute(s.instanceSource, instanceorder, (const SceneObject*)NULL);
+	}
+
+	CompiledScene(const CompiledScene &);
+	CompiledScene & operator=(const CompiledScene &);
+};
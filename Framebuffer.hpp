@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Vec3.hpp"
+#include "TileScheduler.hpp"
+#include "Tonemap.hpp"
+
+// Front and back copies of the 8-bit RGB and linear float images. Tiles are rendered into
+// the back buffers while the front ones are shown or saved, and swap() exchanges them once
+// every tile of a frame is done, so a presented frame never mixes tiles of two frames.
+//
+// Tracing only writes the float image. Once a frame's tiles are done, display() converts it
+// to 8-bit with the tonemap, a band of whole rows at a time.
+//
+// Frames may be traced at a smaller render size, into a separate render image, and then
+// upscaled into the back buffers.
+class Framebuffer
+{
+public:
+	const unsigned width, height;
+	static const unsigned kChannels = 3;    /// RGB
+	static const unsigned kBandRows = 16;   /// rows converted for display by one task
+	const Tonemap tonemap;
+
+	Framebuffer(unsigned width, unsigned height, const Tonemap &tonemap = Tonemap())
+		: width(width), height(height), tonemap(tonemap), back(0), renderwidth(width), renderheight(height)
+	{
+		for (unsigned i = 0; i < 2; ++i) {
+			pixels[i].resize(width * height * kChannels);
+			image[i].resize(width * height);
+		}
+		for (unsigned y = 0; y < height; y += kBandRows) {
+			Tile band = { 0, y, width, std::min(y + kBandRows, height) };
+			rowbands.push_back(band);
+		}
+	}
+
+	// Size frames are traced at, at most the output size. Only call between frames.
+	void setRenderSize(unsigned w, unsigned h)
+	{
+		renderwidth = std::min(w, width), renderheight = std::min(h, height);
+		if (scaled() && renderimage.empty()) renderimage.resize(width * height);
+	}
+
+	unsigned renderWidth() const { return renderwidth; }
+	unsigned renderHeight() const { return renderheight; }
+	bool scaled() const { return renderwidth != width || renderheight != height; }
+
+	// Where tiles write a frame, renderWidth() pixels to a row
+	Vec3f* renderImage() { return scaled() ? renderimage.data() : backImage(); }
+
+	// Bands of whole rows covering the output, for upscale() and display()
+	const std::vector<Tile> &bands() const { return rowbands; }
+
+	// Fill a tile of the back image by bilinear filtering of the render image
+	void upscale(const Tile &tile)
+	{
+		float sx = float(renderwidth) / width, sy = float(renderheight) / height;
+		for (unsigned y = tile.y0; y < tile.y1; ++y) {
+			float fy = std::max(0.0f, (y + 0.5f) * sy - 0.5f);
+			unsigned y0 = std::min((unsigned)fy, renderheight - 1), y1 = std::min(y0 + 1, renderheight - 1);
+			float wy = fy - y0;
+			for (unsigned x = tile.x0; x < tile.x1; ++x) {
+				float fx = std::max(0.0f, (x + 0.5f) * sx - 0.5f);
+				unsigned x0 = std::min((unsigned)fx, renderwidth - 1), x1 = std::min(x0 + 1, renderwidth - 1);
+				float wx = fx - x0;
+				const Vec3f* row0 = renderimage.data() + y0 * renderwidth;
+				const Vec3f* row1 = renderimage.data() + y1 * renderwidth;
+				image[back][x + y * width] = (row0[x0] * (1 - wx) + row0[x1] * wx) * (1 - wy) + (row1[x0] * (1 - wx) + row1[x1] * wx) * wy;
+			}
+		}
+	}
+
+	// Convert a band of the back image to the back 8-bit pixels
+	void display(const Tile &band)
+	{
+		unsigned first = band.y0 * width;
+		tonemap.apply(image[back].data() + first, pixels[back].data() + first * kChannels, (band.y1 - band.y0) * width);
+	}
+
+	char* backPixels() { return pixels[back].data(); }
+	Vec3f* backImage() { return image[back].data(); }
+	const char* frontPixels() const { return pixels[1 - back].data(); }
+	const Vec3f* frontImage() const { return image[1 - back].data(); }
+
+	// Make the frame just rendered the front buffer. Only call once no tile is writing.
+	void swap() { back = 1 - back; }
+
+private:
+	std::vector<char> pixels[2];
+	std::vector<Vec3f> image[2];
+	unsigned back;                          /// index of the buffers being rendered into
+	unsigned renderwidth, renderheight;
+	std::vector<Vec3f> renderimage;         /// frames traced below the output size, allocated once needed
+	std::vector<Tile> rowbands;
+
+	Framebuffer(const Framebuffer &);
+	Framebuffer & operator=(const Framebuffer &);
+};
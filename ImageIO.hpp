@@ -0,0 +1,30 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include "Vec3.hpp"
+
+// Write an 8-bit RGB buffer as a binary PPM (P6)
+inline bool writePPM(const std::string &path, const char* pixels, unsigned width, unsigned height)
+{
+	std::ofstream ofs(path.c_str(), std::ios::out | std::ios::binary);
+	if (!ofs) return false;
+	ofs << "P6\n" << width << " " << height << "\n255\n";
+	ofs.write(pixels, (std::streamsize)width * height * 3);
+	return ofs.good();
+}
+
+// Write a linear float RGB buffer as a little endian PFM. PFM stores rows bottom to top.
+inline bool writePFM(const std::string &path, const Vec3f* image, unsigned width, unsigned height)
+{
+	std::ofstream ofs(path.c_str(), std::ios::out | std::ios::binary);
+	if (!ofs) return false;
+	ofs << "PF\n" << width << " " << height << "\n-1.0\n";
+	for (unsigned y = height; y-- > 0;) {
+		for (unsigned x = 0; x < width; ++x) {
+			const Vec3f &p = image[x + y * width];
+			float rgb[3] = { p.x, p.y, p.z };
+			ofs.write((const char*)rgb, sizeof(rgb));
+		}
+	}
+	return ofs.good();
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "Vec3.hpp"
+#include "Material.hpp"
+#include "SceneObject.hpp"
+#include "Transform.hpp"
+#include "CompiledScene.hpp"
+#include "TriangleMesh.hpp"
+
+// A placement of shared geometry. The geometry is compiled once, with its own BVH, in its
+// own object space, and every instance of it only adds a transform to the scene, so memory
+// grows with the unique geometry rather than with the number of copies. Rays are moved into
+// object space to traverse it.
+//
+// An instance can also spin, turning about an axis by a fixed angle every frame. Spins are
+// placement steps like any other, so one applied before a translation turns the instance
+// in place and one applied after it orbits the origin.
+class Instance : public SceneObject
+{
+public:
+	std::shared_ptr<const CompiledScene> geometry;
+	Transform objectToWorld;                /// placement at the current frame
+
+	// Compile a mesh into geometry that instances can share. The mesh is not needed after.
+	static std::shared_ptr<const CompiledScene> compile(const TriangleMesh &mesh)
+	{
+		std::shared_ptr<CompiledScene> geometry = std::make_shared<CompiledScene>();
+		mesh.compile(*geometry);
+		geometry->build();
+		return geometry;
+	}
+
+	Instance(const std::shared_ptr<const CompiledScene> &geometry, const Transform &objectToWorld)
+		: geometry(geometry), after(objectToWorld)
+	{
+		Material surface;
+		if (geometry->materialCount) surface = geometry->materials[0];
+		surfaceColor = surface.surfaceColour;
+		emissionColor = surface.emissionColour;
+		transparency = surface.transparency;
+		reflection = surface.reflection;
+		animate(0);
+	}
+
+	// Apply step after the placement so far
+	void place(const Transform &step)
+	{
+		after = step * after;
+		animate(0);
+	}
+
+	// Turn about axis, through the origin, by degreesPerFrame every frame after the placement so far
+	void spin(const Vec3f &axis, float degreesPerFrame)
+	{
+		Spin spin = { after, axis, degreesPerFrame };
+		spins.push_back(spin);
+		after = Transform();
+		animate(0);
+	}
+
+	bool animated() const { return !spins.empty(); }
+
+	// Move to where the spins have turned the instance by frame
+	void animate(unsigned frame)
+	{
+		Transform motion;
+		for (unsigned i = 0; i < spins.size(); ++i) {
+			float degrees = std::fmod(spins[i].degreesPerFrame * frame, 360.0f);
+			motion = Transform::rotate(spins[i].axis, degrees) * spins[i].before * motion;
+		}
+		objectToWorld = after * motion;
+		worldToObject = objectToWorld.inverse();
+		center = bounds().valid() ? bounds().centroid() : objectToWorld.point(Vec3f(0));
+	}
+
+	AABB bounds() const
+	{
+		return geometry->nodeCount ? objectToWorld.bounds(geometry->nodes[0].bounds) : AABB();
+	}
+
+	// Rays are traced against the compiled scene, so these are only used when the instance
+	// is a light
+	bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &t, float &u, float &v) const
+	{
+		unsigned primitive, instance;
+		t = std::numeric_limits<float>::max();
+		u = v = 0;
+		return geometry->intersect(worldToObject.point(rayorig), worldToObject.vector(raydir), t, primitive, instance);
+	}
+
+	bool occluded(const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const
+	{
+		return geometry->occluded(worldToObject.point(rayorig), worldToObject.vector(raydir), tmax);
+	}
+
+	void compile(CompiledScene &compiled) const
+	{
+		compiled.addInstance(geometry, objectToWorld, this);
+	}
+
+private:
+	struct Spin
+	{
+		Transform before;                   /// placement steps up to the spin
+		Vec3f axis;
+		float degreesPerFrame;
+	};
+
+	std::vector<Spin> spins;
+	Transform after;                        /// placement steps after the last spin
+	Transform worldToObject;
+};
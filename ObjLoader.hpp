@@ -0,0 +1,212 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Vec3.hpp"
+#include "MappedFile.hpp"
+
+// Reads the vertex positions and faces of Wavefront OBJ files, everything else is skipped.
+// The file is mapped rather than read, cut into one chunk of whole lines per thread and the
+// chunks parsed in parallel, then each chunk's results are copied into place. Only the
+// parsed vertices and indices are held in memory, never the text.
+class ObjLoader
+{
+public:
+	// Fill vertices and indices (three per triangle) from the file. Faces with more than
+	// three vertices are split into a fan of triangles. Returns false, after printing why,
+	// if the file can't be read or a face is malformed or refers to a missing vertex.
+	// threads 0 uses one per hardware thread.
+	static bool load(const std::string &path, std::vector<Vec3f> &vertices, std::vector<unsigned> &indices, unsigned threads = 0)
+	{
+		MappedFile file;
+		if (!file.open(path)) {
+			std::cout << "Can't open " << path << std::endl;
+			return false;
+		}
+
+		if (threads == 0) threads = std::thread::hardware_concurrency();
+		size_t chunksize = std::max(size_t(kMinChunk), file.size() / std::max(1u, threads) + 1);
+		std::vector<Chunk> chunks;
+		const char* begin = file.data();
+		const char* end = file.data() + file.size();
+		while (begin < end) {
+			const char* split = begin + std::min(chunksize, size_t(end - begin));
+			while (split < end && split[-1] != '\n') ++split;
+			chunks.push_back(Chunk());
+			chunks.back().begin = begin;
+			chunks.back().end = split;
+			begin = split;
+		}
+		parallel(chunks, [](Chunk &chunk) { parse(chunk); });
+
+		// Chunks only know the lines and vertices before them once all are parsed
+		size_t lines = 0, vertexcount = 0, indexcount = 0;
+		for (unsigned i = 0; i < chunks.size(); ++i) {
+			Chunk &chunk = chunks[i];
+			if (chunk.errorLine) {
+				std::cout << path << ":" << lines + chunk.errorLine << ": malformed face" << std::endl;
+				return false;
+			}
+			chunk.firstVertex = vertexcount;
+			chunk.firstIndex = indexcount;
+			lines += chunk.lines;
+			vertexcount += chunk.vertices.size();
+			indexcount += chunk.corners.size();
+		}
+
+		vertices.resize(vertexcount);
+		indices.resize(indexcount);
+		parallel(chunks, [&](Chunk &chunk) {
+			std::copy(chunk.vertices.begin(), chunk.vertices.end(), vertices.begin() + chunk.firstVertex);
+			for (size_t c = 0, r = 0; c < chunk.corners.size(); ++c) {
+				int64_t index = chunk.corners[c];
+				if (r < chunk.relative.size() && chunk.relative[r] == c) index += chunk.firstVertex, r++;
+				if (index < 0 || index >= (int64_t)vertexcount) chunk.missingVertex = true;
+				indices[chunk.firstIndex + c] = (unsigned)index;
+			}
+			std::vector<Vec3f>().swap(chunk.vertices);
+			std::vector<int64_t>().swap(chunk.corners);
+		});
+		for (unsigned i = 0; i < chunks.size(); ++i) {
+			if (chunks[i].missingVertex) {
+				std::cout << path << ": face refers to a missing vertex" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	static const size_t kMinChunk = 1 << 20;    /// smaller files are not worth splitting further
+	static const int64_t kMaxInt = 100000000000000000;  /// parsed integers stop growing past this, before they can overflow
+
+	struct Chunk
+	{
+		const char *begin, *end;
+		std::vector<Vec3f> vertices;
+		std::vector<int64_t> corners;       /// zero based vertex of each triangle corner
+		std::vector<size_t> relative;       /// corners given as negative indices, counted from the chunk's first vertex
+		size_t lines = 0;
+		size_t errorLine = 0;               /// line within the chunk of the first malformed face, from 1
+		size_t firstVertex = 0, firstIndex = 0;
+		bool missingVertex = false;
+	};
+
+	template<typename Work>
+	static void parallel(std::vector<Chunk> &chunks, Work work)
+	{
+		std::vector<std::thread> threads;
+		for (unsigned i = 1; i < chunks.size(); ++i)
+			threads.emplace_back([&chunks, &work, i] { work(chunks[i]); });
+		if (!chunks.empty()) work(chunks[0]);
+		for (unsigned i = 0; i < threads.size(); ++i)
+			threads[i].join();
+	}
+
+	static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+	static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+	static void parse(Chunk &chunk)
+	{
+		std::vector<int64_t> face;
+		const char* p = chunk.begin;
+		while (p < chunk.end) {
+			const char* eol = (const char*)memchr(p, '\n', chunk.end - p);
+			if (!eol) eol = chunk.end;
+			chunk.lines++;
+			while (p < eol && isSpace(*p)) ++p;
+			if (eol - p > 1 && p[0] == 'v' && isSpace(p[1])) {
+				float xyz[3] = { 0, 0, 0 };
+				p++;
+				for (unsigned i = 0; i < 3; ++i) p = parseFloat(p, eol, xyz[i]);
+				chunk.vertices.push_back(Vec3f(xyz[0], xyz[1], xyz[2]));
+			}
+			else if (eol - p > 1 && p[0] == 'f' && isSpace(p[1])) {
+				// Each corner is v, v/vt, v//vn or v/vt/vn, only v is used
+				face.clear();
+				p++;
+				while (true) {
+					while (p < eol && isSpace(*p)) ++p;
+					if (p == eol || *p == '#') break;
+					int64_t index;
+					p = parseInt(p, eol, index);
+					if (!p || index == 0) {
+						face.clear();
+						break;
+					}
+					face.push_back(index);
+					while (p < eol && !isSpace(*p)) ++p;
+				}
+				if (face.size() < 3) {
+					if (!chunk.errorLine) chunk.errorLine = chunk.lines;
+				}
+				else {
+					for (unsigned i = 2; i < face.size(); ++i) {
+						addCorner(chunk, face[0]);
+						addCorner(chunk, face[i - 1]);
+						addCorner(chunk, face[i]);
+					}
+				}
+			}
+			p = eol + 1;
+		}
+	}
+
+	// OBJ indices count from 1, or back from the last vertex read if negative
+	static void addCorner(Chunk &chunk, int64_t index)
+	{
+		if (index < 0) {
+			chunk.relative.push_back(chunk.corners.size());
+			chunk.corners.push_back((int64_t)chunk.vertices.size() + index);
+		}
+		else chunk.corners.push_back(index - 1);
+	}
+
+	// Integers with more digits than fit are still read to their end, but their value
+	// saturates, which leaves them out of range as a vertex index and clamped as an exponent
+	static const char* parseInt(const char* p, const char* end, int64_t &value)
+	{
+		bool negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+')) ++p;
+		if (p == end || !isDigit(*p)) return NULL;
+		value = 0;
+		for (; p < end && isDigit(*p); ++p) {
+			if (value < kMaxInt) value = value * 10 + (*p - '0');
+		}
+		if (negative) value = -value;
+		return p;
+	}
+
+	// Decimal number with an optional fraction and exponent, left at 0 if there is none.
+	// Digits are gathered into a double and scaled once, which is exact well beyond float
+	// precision for the number of digits OBJ exporters write.
+	static const char* parseFloat(const char* p, const char* end, float &value)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		while (p < end && isSpace(*p)) ++p;
+		bool negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+')) ++p;
+		double mantissa = 0;
+		int exponent = 0;
+		while (p < end && isDigit(*p)) mantissa = mantissa * 10 + (*p++ - '0');
+		if (p < end && *p == '.') {
+			for (++p; p < end && isDigit(*p); ++p) mantissa = mantissa * 10 + (*p - '0'), exponent--;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			int64_t e;
+			const char* after = parseInt(p + 1, end, e);
+			if (after) p = after, exponent += (int)std::max<int64_t>(-400, std::min<int64_t>(400, e));
+		}
+		double scale = exponent < 0 ? -exponent : exponent;
+		scale = scale <= 22 ? powers[(int)scale] : std::pow(10.0, scale);
+		double result = exponent < 0 ? mantissa / scale : mantissa * scale;
+		value = float(negative ? -result : result);
+		return p;
+	}
+};
@@ -0,0 +1,98 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+enum PixelCurve
+{
+	kCurveScanline,                         /// rows top to bottom, each left to right
+	kCurveMorton,                           /// Z-order, interleaving the bits of x and y
+	kCurveHilbert                           /// Hilbert curve, every step moves to an adjacent pixel
+};
+
+// The order pixels within a tile are traced in. With scanline order consecutive rays are
+// only neighbours along a row, so by the end of each row the rays have moved away from the
+// BVH nodes the previous row used. Morton and Hilbert order visit the tile in small square
+// blocks that grow outward, so rays close in time are also close on screen in both
+// directions. Packets are filled in the same order, so they become compact blocks as well.
+// Both curves cover the smallest power of two square that holds the tile. Offsets outside
+// the tile are skipped, so tiles clipped by the image edge and tile sizes that are not a
+// power of two work too. While no pixels are skipped, packets of 8 rays cover blocks 4 wide
+// and 2 tall in Morton order, and 4x2 or 2x4 blocks in Hilbert order, depending on which
+// way the curve runs through them.
+class PixelOrder
+{
+public:
+	static const unsigned kMaxTileSize = 4096;  /// keeps offsets in 16 bits and the curve's square in 32
+
+	struct Offset
+	{
+		uint16_t x, y;                      /// from the tile's top left corner
+	};
+
+	const PixelCurve curve;
+
+	PixelOrder(PixelCurve curve, unsigned tilesize) : curve(curve)
+	{
+		assert(tilesize <= kMaxTileSize);
+		if (curve == kCurveScanline) {
+			for (unsigned y = 0; y < tilesize; ++y)
+				for (unsigned x = 0; x < tilesize; ++x) add(x, y);
+			return;
+		}
+
+		unsigned side = 1;
+		while (side < tilesize) side *= 2;
+		for (unsigned d = 0; d < side * side; ++d) {
+			unsigned x, y;
+			if (curve == kCurveMorton) x = compactBits(d), y = compactBits(d >> 1);
+			else hilbertPoint(side, d, x, y);
+			if (x < tilesize && y < tilesize) add(x, y);
+		}
+	}
+
+	const std::vector<Offset> &offsets() const { return order; }
+
+	static const char* name(PixelCurve curve)
+	{
+		static const char* names[] = { "scanline", "morton", "hilbert" };
+		return names[curve];
+	}
+
+private:
+	std::vector<Offset> order;
+
+	void add(unsigned x, unsigned y)
+	{
+		Offset offset = { uint16_t(x), uint16_t(y) };
+		order.push_back(offset);
+	}
+
+	// Gather the even bits of v into its low half
+	static unsigned compactBits(unsigned v)
+	{
+		v &= 0x55555555u;
+		v = (v | v >> 1) & 0x33333333u;
+		v = (v | v >> 2) & 0x0F0F0F0Fu;
+		v = (v | v >> 4) & 0x00FF00FFu;
+		v = (v | v >> 8) & 0x0000FFFFu;
+		return v;
+	}
+
+	// Point d along the Hilbert curve over a side x side square, side a power of two
+	static void hilbertPoint(unsigned side, unsigned d, unsigned &x, unsigned &y)
+	{
+		x = y = 0;
+		for (unsigned s = 1; s < side; s *= 2) {
+			unsigned rx = 1 & (d / 2), ry = 1 & (d ^ rx);
+			// Rotate the quadrant so the sub-curve joins its neighbours
+			if (ry == 0) {
+				if (rx == 1) x = s - 1 - x, y = s - 1 - y;
+				std::swap(x, y);
+			}
+			x += s * rx, y += s * ry;
+			d /= 4;
+		}
+	}
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <cmath>
+#include <limits>
+#include "Vec3.hpp"
+
+constexpr unsigned kNoHit = 0xFFFFFFFFu;  /// primitive index of a ray that hit nothing
+
+// A group of up to kSize rays stored as structure of arrays so the packet kernels can load
+// the same component of several rays into one SIMD register.
+struct RayPacket
+{
+	static const unsigned kSize = 8;        /// rays per packet, matches the widest (AVX2) kernels
+
+	alignas(32) float ox[kSize];
+	alignas(32) float oy[kSize];
+	alignas(32) float oz[kSize];
+	alignas(32) float dx[kSize];
+	alignas(32) float dy[kSize];
+	alignas(32) float dz[kSize];
+	alignas(32) float idx[kSize];           /// reciprocal directions for the box tests
+	alignas(32) float idy[kSize];
+	alignas(32) float idz[kSize];
+	alignas(32) float tnear[kSize];         /// closest hit so far, or the shadow ray length
+	unsigned hit[kSize];                    /// primitive hit by each ray, or kNoHit
+	unsigned instance[kSize];               /// instance the hit is on, only set when the hit has CompiledScene::kInstanceBit
+	unsigned active;                        /// bitmask of lanes holding a ray
+	unsigned occluded;                      /// lanes found blocked by an occlusion query
+
+	RayPacket() : active(0), occluded(0)
+	{
+		for (unsigned i = 0; i < kSize; ++i) {
+			ox[i] = oy[i] = oz[i] = dx[i] = dy[i] = dz[i] = idx[i] = idy[i] = idz[i] = 0;
+			tnear[i] = std::numeric_limits<float>::infinity();
+			hit[i] = kNoHit;
+			instance[i] = 0;
+		}
+	}
+
+	void setRay(unsigned lane, const Vec3f &rayorig, const Vec3f &raydir,
+		float tmax = std::numeric_limits<float>::infinity())
+	{
+		ox[lane] = rayorig.x, oy[lane] = rayorig.y, oz[lane] = rayorig.z;
+		dx[lane] = raydir.x, dy[lane] = raydir.y, dz[lane] = raydir.z;
+		idx[lane] = 1 / raydir.x, idy[lane] = 1 / raydir.y, idz[lane] = 1 / raydir.z;
+		tnear[lane] = tmax;
+		hit[lane] = kNoHit;
+		active |= 1u << lane;
+		occluded &= ~(1u << lane);
+	}
+
+	Vec3f origin(unsigned lane) const { return Vec3f(ox[lane], oy[lane], oz[lane]); }
+	Vec3f direction(unsigned lane) const { return Vec3f(dx[lane], dy[lane], dz[lane]); }
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "Vec3.hpp"
+#include "AABB.hpp"
+#include "RayPacket.hpp"
+
+// Rays waiting for a stage of wavefront rendering, stored as structure of arrays like a
+// RayPacket but of any length. Stages walk one queue from start to end, so each component
+// is read in order, and fill packets from it for the SIMD kernels. Queues are cleared
+// rather than freed between uses, so once grown to a tile's worth of rays they stop
+// allocating.
+struct RayQueue
+{
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<float> tnear;               /// closest hit once intersected, or the shadow ray length
+	std::vector<unsigned> hit;              /// primitive hit by each ray, or kNoHit
+	std::vector<unsigned> instance;         /// instance the hit is on, as in RayPacket
+	std::vector<float> wr, wg, wb;          /// weight of the ray's colour in its pixel, for shadow rays the light it adds if unblocked
+	std::vector<unsigned> pixel;            /// slot of the pixel the ray adds to
+	std::vector<unsigned> depth;            /// bounces since the primary hit
+
+	size_t size() const { return pixel.size(); }
+	bool empty() const { return pixel.empty(); }
+
+	void clear()
+	{
+		ox.clear(), oy.clear(), oz.clear();
+		dx.clear(), dy.clear(), dz.clear();
+		tnear.clear(), hit.clear(), instance.clear();
+		wr.clear(), wg.clear(), wb.clear();
+		pixel.clear(), depth.clear();
+	}
+
+	void push(const Vec3f &rayorig, const Vec3f &raydir, const Vec3f &weight, unsigned slot, unsigned bounces,
+		float tmax = std::numeric_limits<float>::infinity())
+	{
+		ox.push_back(rayorig.x), oy.push_back(rayorig.y), oz.push_back(rayorig.z);
+		dx.push_back(raydir.x), dy.push_back(raydir.y), dz.push_back(raydir.z);
+		tnear.push_back(tmax), hit.push_back(kNoHit), instance.push_back(0);
+		wr.push_back(weight.x), wg.push_back(weight.y), wb.push_back(weight.z);
+		pixel.push_back(slot), depth.push_back(bounces);
+	}
+
+	// Append ray i of another queue
+	void append(const RayQueue &queue, size_t i)
+	{
+		push(queue.origin(i), queue.direction(i), queue.weight(i), queue.pixel[i], queue.depth[i], queue.tnear[i]);
+		hit.back() = queue.hit[i], instance.back() = queue.instance[i];
+	}
+
+	// Octant of the direction of ray i, a bit per negative component
+	unsigned octant(size_t i) const { return (dx[i] < 0) | (dy[i] < 0) << 1 | (dz[i] < 0) << 2; }
+
+	// Reorder the rays so ones heading into the same octant are together, and within an
+	// octant ones that start near each other, by the Morton code of their origin within the
+	// bounds of all the origins. Packets filled from the queue afterwards then tend to
+	// visit the same BVH nodes. order and scratch are working space kept by the caller.
+	void sortCoherent(std::vector<uint64_t> &order, RayQueue &scratch)
+	{
+		AABB bounds;
+		for (size_t i = 0; i < size(); ++i) bounds.expand(origin(i));
+		Vec3f extent = bounds.bmax - bounds.bmin;
+		Vec3f scale(extent.x > 0 ? 511 / extent.x : 0, extent.y > 0 ? 511 / extent.y : 0, extent.z > 0 ? 511 / extent.z : 0);
+
+		order.resize(size());
+		for (size_t i = 0; i < size(); ++i) {
+			unsigned x = unsigned((ox[i] - bounds.bmin.x) * scale.x);
+			unsigned y = unsigned((oy[i] - bounds.bmin.y) * scale.y);
+			unsigned z = unsigned((oz[i] - bounds.bmin.z) * scale.z);
+			// 3 octant bits above a 27 bit Morton code, so the key fits the upper half of order
+			uint32_t key = octant(i) << 27 | mortonCode(x, y, z);
+			order[i] = uint64_t(key) << 32 | i;
+		}
+		std::sort(order.begin(), order.end());
+
+		scratch.clear();
+		for (size_t i = 0; i < order.size(); ++i) scratch.append(*this, size_t(order[i] & 0xFFFFFFFFu));
+		std::swap(*this, scratch);
+	}
+
+	// Interleave the bits of three 9 bit coordinates
+	static unsigned mortonCode(unsigned x, unsigned y, unsigned z)
+	{
+		return spreadBits(x) | spreadBits(y) << 1 | spreadBits(z) << 2;
+	}
+
+	Vec3f origin(size_t i) const { return Vec3f(ox[i], oy[i], oz[i]); }
+	Vec3f direction(size_t i) const { return Vec3f(dx[i], dy[i], dz[i]); }
+	Vec3f weight(size_t i) const { return Vec3f(wr[i], wg[i], wb[i]); }
+
+	// Load rays first onwards into a packet, as many as fit, returning how many
+	unsigned load(RayPacket &packet, size_t first) const
+	{
+		packet = RayPacket();
+		unsigned lanes = (unsigned)std::min<size_t>(RayPacket::kSize, size() - first);
+		for (unsigned i = 0; i < lanes; ++i)
+			packet.setRay(i, origin(first + i), direction(first + i), tnear[first + i]);
+		return lanes;
+	}
+
+private:
+	// Move the low 9 bits of v two bits apart
+	static unsigned spreadBits(unsigned v)
+	{
+		v = std::min(v, 511u);
+		v = (v | v << 16) & 0x030000FFu;
+		v = (v | v << 8) & 0x0300F00Fu;
+		v = (v | v << 4) & 0x030C30C3u;
+		v = (v | v << 2) & 0x09249249u;
+		return v;
+	}
+};
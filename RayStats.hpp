@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum RayType
+{
+	kRayPrimary,
+	kRayReflection,
+	kRayRefraction,
+	kRayShadow,
+	kRayTypes
+};
+
+// Number of rays traced of each type, and the traversal work they took
+struct RayCounts
+{
+	uint64_t rays[kRayTypes];
+	uint64_t intersectionTests;             /// ray or packet against primitive tests
+	uint64_t nodeVisits;                    /// BVH nodes entered by a ray or packet
+	uint64_t secondaryPackets;              /// packets of reflection and refraction rays traced by the wavefront
+	uint64_t secondaryOctants;              /// direction octants in those packets, summed over the packets
+	uint64_t secondaryVisits;               /// BVH nodes entered by those packets
+
+	uint64_t total() const
+	{
+		uint64_t sum = 0;
+		for (unsigned i = 0; i < kRayTypes; ++i) sum += rays[i];
+		return sum;
+	}
+
+	double octantsPerPacket() const { return secondaryPackets ? double(secondaryOctants) / secondaryPackets : 0; }
+
+	// Counts since an earlier snapshot
+	RayCounts operator-(const RayCounts &earlier) const
+	{
+		RayCounts counts;
+		for (unsigned i = 0; i < kRayTypes; ++i) counts.rays[i] = rays[i] - earlier.rays[i];
+		counts.intersectionTests = intersectionTests - earlier.intersectionTests;
+		counts.nodeVisits = nodeVisits - earlier.nodeVisits;
+		counts.secondaryPackets = secondaryPackets - earlier.secondaryPackets;
+		counts.secondaryOctants = secondaryOctants - earlier.secondaryOctants;
+		counts.secondaryVisits = secondaryVisits - earlier.secondaryVisits;
+		return counts;
+	}
+
+	static const char* name(RayType type)
+	{
+		static const char* names[kRayTypes] = { "primary", "reflection", "refraction", "shadow" };
+		return names[type];
+	}
+};
+
+// Process wide count of the rays traced by every thread, for reporting. Each thread adds
+// to its own block of counters, padded so no two blocks share a cache line, and the blocks
+// are only summed when a snapshot is taken. Counters only ever grow, so a measurement is
+// the difference between two snapshots. Blocks outlive their threads and are handed to
+// the next thread started, so no counts are lost when a pool is torn down.
+class RayStats
+{
+public:
+	static void add(RayType type, uint64_t count = 1) { increment(local().rays[type], count); }
+
+	// Traversal work of one query, added once the query is done rather than per node
+	static void addTraversal(uint64_t tests, uint64_t visits)
+	{
+		Block &block = local();
+		increment(block.intersectionTests, tests);
+		increment(block.nodeVisits, visits);
+	}
+
+	// Coherence of one packet of secondary rays: how many octants its rays head into and
+	// how many nodes it took to trace
+	static void addSecondaryPacket(unsigned octants, uint64_t visits)
+	{
+		Block &block = local();
+		increment(block.secondaryPackets, 1);
+		increment(block.secondaryOctants, octants);
+		increment(block.secondaryVisits, visits);
+	}
+
+	// Nodes entered by the calling thread so far, to measure a query's share of them
+	static uint64_t threadNodeVisits() { return local().nodeVisits.load(std::memory_order_relaxed); }
+
+	static RayCounts snapshot()
+	{
+		RayCounts counts = RayCounts();
+		Registry &blocks = registry();
+		std::lock_guard<std::mutex> lock(blocks.mutex);
+		for (unsigned b = 0; b < blocks.storage.size(); ++b) {
+			const Block &block = blocks.storage[b]->block;
+			for (unsigned i = 0; i < kRayTypes; ++i)
+				counts.rays[i] += block.rays[i].load(std::memory_order_relaxed);
+			counts.intersectionTests += block.intersectionTests.load(std::memory_order_relaxed);
+			counts.nodeVisits += block.nodeVisits.load(std::memory_order_relaxed);
+			counts.secondaryPackets += block.secondaryPackets.load(std::memory_order_relaxed);
+			counts.secondaryOctants += block.secondaryOctants.load(std::memory_order_relaxed);
+			counts.secondaryVisits += block.secondaryVisits.load(std::memory_order_relaxed);
+		}
+		return counts;
+	}
+
+private:
+	static const unsigned kCacheLine = 64;
+
+	// Only the owning thread writes a block, so its counters are atomic just to let
+	// snapshot() read them, and are updated with a plain load and store rather than a
+	// locked read-modify-write
+	struct Counters
+	{
+		std::atomic<uint64_t> rays[kRayTypes];
+		std::atomic<uint64_t> intersectionTests, nodeVisits;
+		std::atomic<uint64_t> secondaryPackets, secondaryOctants, secondaryVisits;
+	};
+
+	// A whole line of padding either side keeps the counters off their neighbours' lines
+	// without needing over-aligned allocation
+	struct Block : Counters
+	{
+		char padding[kCacheLine];
+
+		Block()
+		{
+			for (unsigned i = 0; i < kRayTypes; ++i) rays[i].store(0, std::memory_order_relaxed);
+			intersectionTests.store(0, std::memory_order_relaxed);
+			nodeVisits.store(0, std::memory_order_relaxed);
+			secondaryPackets.store(0, std::memory_order_relaxed);
+			secondaryOctants.store(0, std::memory_order_relaxed);
+			secondaryVisits.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	struct PaddedBlock
+	{
+		char padding[kCacheLine];
+		Block block;
+	};
+
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<PaddedBlock>> storage;    /// every block ever handed out
+		std::vector<Block*> unused;         /// blocks of threads that have exited
+	};
+
+	// Returns a thread's block to the registry when the thread exits
+	struct Owner
+	{
+		Block* block = NULL;
+
+		~Owner()
+		{
+			if (!block) return;
+			Registry &blocks = registry();
+			std::lock_guard<std::mutex> lock(blocks.mutex);
+			blocks.unused.push_back(block);
+		}
+	};
+
+	static void increment(std::atomic<uint64_t> &counter, uint64_t count)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+	}
+
+	static Registry & registry()
+	{
+		static Registry* blocks = new Registry();   // never destroyed, threads may exit after main
+		return *blocks;
+	}
+
+	static Block & local()
+	{
+		static thread_local Block* block = NULL;
+		if (!block) block = acquire();
+		return *block;
+	}
+
+	static Block* acquire()
+	{
+		static thread_local Owner owner;
+		Registry &blocks = registry();
+		std::lock_guard<std::mutex> lock(blocks.mutex);
+		if (!blocks.unused.empty()) {
+			owner.block = blocks.unused.back();
+			blocks.unused.pop_back();
+		}
+		else {
+			blocks.storage.emplace_back(new PaddedBlock());
+			owner.block = &blocks.storage.back()->block;
+		}
+		return owner.block;
+	}
+};
@@ -13,17 +13,38 @@
 #include <chrono>
 #include <math.h>
 #include <thread>
+#include <future>
+#include <memory>
 
+#ifndef RAYTRACER_NO_SDL
 #include <SDL.h>
+#endif
 #include "ctpl_stl.h"
 
 #include "Vec3.hpp"
-#include "material.hpp"
+#include "Material.hpp"
 #include "SceneObject.hpp"
 #include "Sphere.hpp"
 #include "Triangle.hpp"
-
-#define MAX_RAY_DEPTH 5
+#include "TriangleMesh.hpp"
+#include "Scene.hpp"
+#include "RenderOptions.hpp"
+#include "ImageIO.hpp"
+#include "RayPacket.hpp"
+#include "RayQueue.hpp"
+#include "SIMD.hpp"
+#include "TileScheduler.hpp"
+#include "PixelOrder.hpp"
+#include "Camera.hpp"
+#include "RenderContext.hpp"
+#include "Framebuffer.hpp"
+#include "AccumulationBuffer.hpp"
+#include "ResolutionScaler.hpp"
+#include "RayStats.hpp"
+#include "Scenes.hpp"
+#include "Benchmark.hpp"
+#include "SceneFile.hpp"
+#include "SceneCache.hpp"
 
 #if defined __linux__ || defined __APPLE__ 
 // "Compiled for Linux
@@ -57,303 +78,751 @@ public:
 
 
 
+const float kRayBias = 1e-4f;               /// how far secondary and shadow rays start off the surface, so they miss it
+
 float mix(const float &a, const float &b, const float &mix)
 {
 	return b * mix + a * (1 - mix);
 }
 
-Vec3f trace(
+// Point of intersection and the surface normal facing the incoming ray
+void hitGeometry(
 	const Vec3f &rayorig,
 	const Vec3f &raydir,
-	const std::vector<SceneObject*> &scene,
-	const int &depth)
+	const float &tnear,
+	const Scene &scene,
+	unsigned primitive,
+	unsigned instance,
+	Vec3f &phit,
+	Vec3f &nhit,
+	bool &inside)
 {
-	//if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
-	float tnear = INFINITY;
-	const SceneObject* sceneobject = NULL;
-	// find intersection of this ray with the sphere in the scene
-	for (unsigned i = 0; i < scene.size(); ++i) {
-		float t0 = INFINITY, t1 = INFINITY, t2 = INFINITY;
-		if (scene[i]->intersect(rayorig, raydir, t0, t1, t2)) {
-			if (t0 < 0) t0 = t1;
-			if (t0 < tnear) {
-				tnear = t0;
-				sceneobject = scene[i];
-			}
-		}
-	}
-	// if there's no intersection return black or background color
-	if (!sceneobject) return Vec3f(2);
-
-	/*std::cout << "Surface Colour: " << sceneobject->surfaceColor << std::endl;*/
-
-	// Just return surface colour for now
-	//return(sceneobject->surfaceColor);
-
-	Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray 
-	Vec3f phit = rayorig + raydir * tnear; // point of intersection 
-	Vec3f nhit = phit - sceneobject->center; // normal at the intersection point 
+	phit = rayorig + raydir * tnear; // point of intersection 
+	nhit = scene.normal(primitive, instance, phit); // normal at the intersection point 
 	nhit.normalize(); // normalize normal direction 
 					  // If the normal and the view direction are not opposite to each other
 					  // reverse the normal direction. That also means we are inside the sphere so set
 					  // the inside bool to true. Finally reverse the sign of IdotN which we want
 					  // positive.
-	float bias = 1e-4; // add some bias to the point from which we will be tracing 
-	bool inside = false;
+	inside = false;
 	if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
-	if ((sceneobject->transparency > 0 || sceneobject->reflection > 0) && depth < MAX_RAY_DEPTH) {
-		float facingratio = -raydir.dot(nhit);
-		// change the mix value to tweak the effect
-		float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
-		// compute reflection direction (not need to normalize because all vectors
-		// are already normalized)
-		Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
-		refldir.normalize();
-		Vec3f reflection = trace(phit + nhit * bias, refldir, scene, depth + 1);
-		Vec3f refraction = 0;
-		// if the sphere is also transparent compute refraction ray (transmission)
-		if (sceneobject->transparency > 0) {
-			float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface? 
-			float cosi = -nhit.dot(raydir);
-			float k = 1 - eta * eta * (1 - cosi * cosi);
-			Vec3f refrdir = raydir * eta + nhit * (eta *  cosi - sqrt(k));
-			refrdir.normalize();
-			refraction = trace(phit - nhit * bias, refrdir, scene, depth + 1);
-		}
-		// the result is a mix of reflection and refraction (if the sphere is transparent)
-		surfaceColor = (
-			reflection * fresneleffect * sceneobject->reflection +
-			refraction * (1 - fresneleffect) * sceneobject->transparency) * sceneobject->surfaceColor;
+}
+
+// Shadow ray from a diffuse hit towards a light, and the light the hit gets from it if
+// nothing blocks the ray. tlight stops at the light's surface so only objects in front of
+// the light can block it.
+Vec3f directLight(
+	const Material &material,
+	const SceneObject* light,
+	const Vec3f &phit,
+	const Vec3f &nhit,
+	Vec3f &shadoworig,
+	Vec3f &lightDirection,
+	float &tlight)
+{
+	shadoworig = phit + nhit * kRayBias;
+	lightDirection = light->center - phit;
+	tlight = lightDirection.length();
+	lightDirection.normalize();
+	float t0 = INFINITY, t1 = INFINITY, t2 = INFINITY;
+	if (light->intersect(shadoworig, lightDirection, t0, t1, t2)) tlight = t0 < 0 ? t1 : t0;
+	tlight -= kRayBias;
+	return material.surfaceColour * std::max(float(0), nhit.dot(lightDirection)) * light->emissionColor;
+}
+
+// A reflection or refraction ray still to be followed, with the weight its colour adds to
+// the result with: the product of the surface colours and mix factors along its path
+struct PendingRay
+{
+	Vec3f orig, dir;
+	Vec3f weight;
+	unsigned depth;                         /// bounces since the primary hit
+};
+
+// The rays a hit on a reflective or transparent surface continues as: a reflection and, if
+// the surface is transparent, a refraction, mixed by a fresnel term and weighted by the
+// surface colour. They are written to secondary, refraction first, and their number is
+// returned. Diffuse hits, and every hit once the ray is maxdepth bounces deep, continue as
+// none and are lit by directLight() instead. shade(), tracePacket() and shadeQueue() all
+// shade through this and directLight(), so every way of tracing renders the same model.
+unsigned secondaryRays(
+	const PendingRay &ray,
+	const Material &material,
+	unsigned maxdepth,
+	const Vec3f &phit,
+	const Vec3f &nhit,
+	bool inside,
+	PendingRay* secondary)
+{
+	if (!(material.transparency > 0 || material.reflection > 0) || ray.depth >= maxdepth) return 0;
+	unsigned count = 0;
+	float facingratio = -ray.dir.dot(nhit);
+	// change the mix value to tweak the effect
+	float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
+	Vec3f weight = ray.weight * material.surfaceColour;
+	// if the sphere is also transparent compute refraction ray (transmission)
+	if (material.transparency > 0) {
+		float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface? 
+		float cosi = -nhit.dot(ray.dir);
+		float k = 1 - eta * eta * (1 - cosi * cosi);
+		Vec3f refrdir = ray.dir * eta + nhit * (eta *  cosi - sqrt(k));
+		refrdir.normalize();
+		RayStats::add(kRayRefraction);
+		PendingRay refraction = { phit - nhit * kRayBias, refrdir, weight * ((1 - fresneleffect) * material.transparency), ray.depth + 1 };
+		secondary[count++] = refraction;
 	}
-	else {
-		// it's a diffuse object, no need to raytrace any further
-		for (unsigned i = 0; i < scene.size(); ++i) {
-			if (scene[i]->emissionColor.x > 0) {
-				// this is a light
-				Vec3f transmission = 0;
-				Vec3f lightDirection = scene[i]->center - phit;
-				lightDirection.normalize();
-				for (unsigned j = 0; j < scene.size(); ++j) {
-					if (i != j) {
-						float t0, t1, t2;
-						if (scene[j]->intersect(phit + nhit * bias, lightDirection, t0, t1, t2)) {
-							transmission = 1;
-							break;
-						}
-					}
-				}
-
-
-
-				surfaceColor += sceneobject->surfaceColor * transmission *
-					std::max(float(0), nhit.dot(lightDirection)) * scene[i]->emissionColor;
+	// compute reflection direction (not need to normalize because all vectors
+	// are already normalized)
+	Vec3f refldir = ray.dir - nhit * 2 * ray.dir.dot(nhit);
+	refldir.normalize();
+	RayStats::add(kRayReflection);
+	PendingRay reflection = { phit + nhit * kRayBias, refldir, weight * (fresneleffect * material.reflection), ray.depth + 1 };
+	secondary[count++] = reflection;
+	return count;
+}
 
+// Colour of a ray that hit primitive (of instance, for hits on one) at distance tnear.
+// Reflective and transparent surfaces do not recurse, they push their secondary rays onto a
+// fixed-size stack that is followed until it is empty, so a ray tree of any shape uses one
+// call frame. The refraction is pushed first so the reflection is followed first. Each hit
+// below maxdepth pushes at most two rays after popping one, so the stack never holds more
+// than maxdepth + 1 of them.
+Vec3f shade(
+	const Vec3f &rayorig,
+	const Vec3f &raydir,
+	const Scene &scene,
+	unsigned maxdepth,
+	float tnear,
+	unsigned primitive,
+	unsigned instance)
+{
+	PendingRay stack[kMaxRayDepth + 1];
+	unsigned pending = 0;
+	PendingRay ray = { rayorig, raydir, Vec3f(1), 0 };
+	Vec3f result = 0;
+
+	while (true) {
+		const Material &material = scene.material(primitive, instance);
+		Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray 
+		Vec3f phit, nhit;
+		bool inside;
+		hitGeometry(ray.orig, ray.dir, tnear, scene, primitive, instance, phit, nhit, inside);
+		unsigned secondary = secondaryRays(ray, material, maxdepth, phit, nhit, inside, stack + pending);
+		pending += secondary;
+		if (!secondary) {
+			// it's a diffuse object, no need to raytrace any further
+			for (unsigned i = 0; i < scene.lights.size(); ++i) {
+				Vec3f shadoworig, lightDirection;
+				float tlight;
+				Vec3f lit = directLight(material, scene.lights[i], phit, nhit, shadoworig, lightDirection, tlight);
+				RayStats::add(kRayShadow);
+				if (!scene.occluded(shadoworig, lightDirection, tlight)) surfaceColor += lit;
 			}
 		}
-		//Vec3f reflection(0);
+		result += ray.weight * (surfaceColor + material.emissionColour);
+
+		// Find the next pending ray that hits something, the ones that miss see the background
+		do {
+			if (pending == 0) return result;
+			ray = stack[--pending];
+			tnear = INFINITY;
+			primitive = kNoHit;
+			if (scene.intersect(ray.orig, ray.dir, tnear, primitive, instance)) break;
+			result += ray.weight * Vec3f(2);
+		} while (true);
+	}
+}
 
-		//if (depth < MAX_RAY_DEPTH) {
-		//	Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
-		//	refldir.normalize();
-		//	reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
-		//}
-		////surfaceColor += reflection * 0.1;
+Vec3f trace(
+	const Vec3f &rayorig,
+	const Vec3f &raydir,
+	const Scene &scene,
+	unsigned maxdepth)
+{
+	//if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
+	float tnear = INFINITY;
+	unsigned primitive = kNoHit, instance = 0;
+	// find the closest intersection of this ray with the scene
+	// if there's no intersection return black or background color
+	if (!scene.intersect(rayorig, raydir, tnear, primitive, instance)) return Vec3f(2);
+
+	return shade(rayorig, raydir, scene, maxdepth, tnear, primitive, instance);
+}
+
+// Trace a packet of primary rays. Closest hits and the shadow rays of diffuse surfaces are
+// found for the whole packet at once, reflective and transparent hits continue one ray at
+// a time through shade().
+void tracePacket(RayPacket &packet, const Scene &scene, unsigned maxdepth, Vec3f* results)
+{
+	scene.intersectPacket(packet);
+
+	Vec3f phit[RayPacket::kSize], nhit[RayPacket::kSize], surfaceColor[RayPacket::kSize];
+	const Material* materials[RayPacket::kSize];
+	unsigned diffuse = 0;
+	for (unsigned i = 0; i < RayPacket::kSize; ++i) {
+		if (!(packet.active & (1u << i))) continue;
+		if (packet.hit[i] == kNoHit) {
+			results[i] = Vec3f(2);
+			continue;
+		}
+		const Material &material = *(materials[i] = &scene.material(packet.hit[i], packet.instance[i]));
+		if (material.transparency > 0 || material.reflection > 0) {
+			results[i] = shade(packet.origin(i), packet.direction(i), scene, maxdepth, packet.tnear[i], packet.hit[i], packet.instance[i]);
+		}
+		else {
+			bool inside;
+			hitGeometry(packet.origin(i), packet.direction(i), packet.tnear[i], scene, packet.hit[i], packet.instance[i],
+				phit[i], nhit[i], inside);
+			surfaceColor[i] = 0;
+			diffuse |= 1u << i;
+		}
+	}
+	if (!diffuse) return;
+
+	for (unsigned l = 0; l < scene.lights.size(); ++l) {
+		const SceneObject* light = scene.lights[l];
+		RayPacket shadow;
+		Vec3f lit[RayPacket::kSize];
+		unsigned shadowrays = 0;
+		for (unsigned i = 0; i < RayPacket::kSize; ++i) {
+			if (!(diffuse & (1u << i))) continue;
+			Vec3f shadoworig, lightDirection;
+			float tlight;
+			lit[i] = directLight(*materials[i], light, phit[i], nhit[i], shadoworig, lightDirection, tlight);
+			shadow.setRay(i, shadoworig, lightDirection, tlight);
+			shadowrays++;
+		}
+		RayStats::add(kRayShadow, shadowrays);
+		scene.occludedPacket(shadow);
+		for (unsigned i = 0; i < RayPacket::kSize; ++i) {
+			if (diffuse & ~shadow.occluded & (1u << i)) surfaceColor[i] += lit[i];
+		}
 	}
 
-	return surfaceColor + sceneobject->emissionColor;
+	for (unsigned i = 0; i < RayPacket::kSize; ++i) {
+		if (diffuse & (1u << i)) results[i] = surfaceColor[i] + materials[i]->emissionColour;
+	}
 }
 
-void threadedTrace(
-	int id,
-	const Vec3f &rayorig,
-	const std::vector<SceneObject*> &scene,
-	const int &depth,
-	char* pixels,
-	std::atomic<int>* totalrays,
-	unsigned totalframes,
-	unsigned width,
-	unsigned height,
-	unsigned raysperbatch,
-	unsigned tiles,
-	unsigned tilesj,
-	unsigned tilesi)
+// Queues of a tile's wavefront, and the pixels its primary rays were generated for
+struct Wavefront
 {
+	RayQueue rays, next;
+	std::vector<RayQueue> shadows;          /// one queue per light, so each packet of them heads the same way
+	RayQueue scratch;                       /// working space for sorting secondary rays
+	std::vector<uint64_t> order;
+	std::vector<unsigned> pixels;           /// image index of each slot
+	std::vector<Vec3f> results;             /// colour gathered by each slot's rays
+
+	void addPrimary(unsigned index, const Vec3f &rayorig, const Vec3f &raydir)
+	{
+		rays.push(rayorig, raydir, Vec3f(1), (unsigned)pixels.size(), 0);
+		pixels.push_back(index);
+		results.push_back(Vec3f(0));
+	}
+};
 
-	float invWidth = 1 / float(width), invHeight = 1 / float(height);
-	float fov = 70, aspectratio = width / float(height);
-	float angle = tan(M_PI * 0.5 * fov / 180.);
+// Find the closest hits of a queue of rays, a packet at a time. For secondary rays the
+// coherence of each packet is added to the stats.
+void intersectQueue(RayQueue &queue, const Scene &scene, bool secondary)
+{
+	for (size_t first = 0; first < queue.size(); first += RayPacket::kSize) {
+		RayPacket packet;
+		unsigned lanes = queue.load(packet, first);
+		uint64_t visits = secondary ? RayStats::threadNodeVisits() : 0;
+		scene.intersectPacket(packet);
+		for (unsigned i = 0; i < lanes; ++i) {
+			queue.tnear[first + i] = packet.tnear[i];
+			queue.hit[first + i] = packet.hit[i], queue.instance[first + i] = packet.instance[i];
+		}
 
-	std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-	auto duration = now.time_since_epoch();
-	auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+		if (!secondary) continue;
+		unsigned octants = 0, distinct = 0;
+		for (unsigned i = 0; i < lanes; ++i) octants |= 1u << queue.octant(first + i);
+		for (; octants; octants &= octants - 1) distinct++;
+		RayStats::addSecondaryPacket(distinct, RayStats::threadNodeVisits() - visits);
+	}
+}
 
-	srand(millis);
+// Test a queue of shadow rays a packet at a time, adding the light of the unblocked ones to
+// their pixels
+void occludeQueue(const RayQueue &shadows, const Scene &scene, std::vector<Vec3f> &results)
+{
+	for (size_t first = 0; first < shadows.size(); first += RayPacket::kSize) {
+		RayPacket packet;
+		unsigned lanes = shadows.load(packet, first);
+		scene.occludedPacket(packet);
+		for (unsigned i = 0; i < lanes; ++i) {
+			if (!(packet.occluded & (1u << i))) results[shadows.pixel[first + i]] += shadows.weight(first + i);
+		}
+	}
+	RayStats::add(kRayShadow, shadows.size());
+}
 
+// Shade a queue of intersected rays, as shade() does one at a time. Misses and emission are
+// added to the results straight away, reflective and transparent hits push their secondary
+// rays onto next and diffuse hits push a shadow ray onto the queue of each light, carrying
+// the light it adds if nothing blocks it.
+void shadeQueue(const RayQueue &rays, const Scene &scene, unsigned maxdepth, RayQueue &next, std::vector<RayQueue> &shadows,
+	std::vector<Vec3f> &results)
+{
+	for (size_t r = 0; r < rays.size(); ++r) {
+		PendingRay ray = { rays.origin(r), rays.direction(r), rays.weight(r), rays.depth[r] };
+		unsigned slot = rays.pixel[r];
+		if (rays.hit[r] == kNoHit) {
+			results[slot] += ray.weight * Vec3f(2);
+			continue;
+		}
 
-	float tilewidth = (float)width / (float)tiles;
-	float tileheight = (float)height / (float)tiles;
+		const Material &material = scene.material(rays.hit[r], rays.instance[r]);
+		Vec3f phit, nhit;
+		bool inside;
+		hitGeometry(ray.orig, ray.dir, rays.tnear[r], scene, rays.hit[r], rays.instance[r], phit, nhit, inside);
+		results[slot] += ray.weight * material.emissionColour;
+
+		PendingRay secondary[2];
+		unsigned count = secondaryRays(ray, material, maxdepth, phit, nhit, inside, secondary);
+		for (unsigned i = 0; i < count; ++i)
+			next.push(secondary[i].orig, secondary[i].dir, secondary[i].weight, slot, secondary[i].depth);
+		if (count) continue;
+		for (unsigned i = 0; i < scene.lights.size(); ++i) {
+			Vec3f shadoworig, lightDirection;
+			float tlight;
+			Vec3f lit = directLight(material, scene.lights[i], phit, nhit, shadoworig, lightDirection, tlight);
+			shadows[i].push(shadoworig, lightDirection, ray.weight * lit, slot, 0, tlight);
+		}
+	}
+}
 
+// Trace the primary rays queued in wavefront to completion a stage at a time: intersect the
+// whole queue, shade it into the queues of secondary and shadow rays, test the shadow rays,
+// then go again with the secondary rays until none are left. With sortrays the secondary
+// rays are sorted by direction and origin before each round so packets of them stay coherent.
+void traceWavefront(Wavefront &wavefront, const Scene &scene, unsigned maxdepth, bool sortrays)
+{
+	for (unsigned depth = 0; !wavefront.rays.empty(); ++depth) {
+		if (depth > 0 && sortrays) wavefront.rays.sortCoherent(wavefront.order, wavefront.scratch);
+		intersectQueue(wavefront.rays, scene, depth > 0);
+		wavefront.next.clear();
+		wavefront.shadows.resize(scene.lights.size());
+		for (unsigned l = 0; l < wavefront.shadows.size(); ++l) wavefront.shadows[l].clear();
+		shadeQueue(wavefront.rays, scene, maxdepth, wavefront.next, wavefront.shadows, wavefront.results);
+		for (unsigned l = 0; l < wavefront.shadows.size(); ++l) occludeQueue(wavefront.shadows[l], scene, wavefront.results);
+		std::swap(wavefront.rays, wavefront.next);
+	}
+}
 
-	//unsigned test = tilex + tiley;
+// Add a sample to the accumulated pixel and write the new average to the frame's image
+void writePixel(const RenderContext &context, unsigned index, const Vec3f &traceresult)
+{
+	context.image[index] = context.accumulation->add(index, traceresult);
+}
 
-	unsigned pixelsprocessed = 0;
+// Write a converged pixel's average to the frame's image without sampling it again
+void copyPixel(const RenderContext &context, unsigned index)
+{
+	context.image[index] = context.accumulation->average(index);
+}
 
-	for (unsigned tiley = tilesi * tileheight; tiley < (tilesi * tileheight) + tileheight; tiley++)
+// Trace the primary rays of one tile of the frame described by context. Pixels that have
+// converged are copied rather than traced, and with adaptive sampling the tile is gone over
+// again for pixels whose error is still above the threshold, until none are left. In
+// wavefront mode each pass's rays are queued and traced together at the end of the pass.
+void threadedTrace(int id, const RenderContext &context, const Tile &tile)
+{
+	const Scene &scene = context.scene;
+	const AccumulationBuffer &accumulation = *context.accumulation;
+	const std::vector<PixelOrder::Offset> &order = context.order.offsets();
+	unsigned pixelsprocessed = 0;
 
-		//for (unsigned tilex = 0; tilex <  128; tilex++)
+	// Primary rays are gathered into packets in the tile's pixel order, packetpixels
+	// remembers where each lane's result goes
+	RayPacket packet;
+	unsigned packetpixels[RayPacket::kSize];
+	unsigned lanes = 0;
+	auto flushPacket = [&]() {
+		Vec3f results[RayPacket::kSize];
+		tracePacket(packet, scene, context.maxDepth, results);
+		for (unsigned i = 0; i < lanes; i++)
+			writePixel(context, packetpixels[i], results[i]);
+		packet = RayPacket();
+		lanes = 0;
+	};
+
+	// The wavefront's queues belong to the thread, so they keep their storage between tiles
+	static thread_local Wavefront wavefront;
+	auto flushWavefront = [&]() {
+		traceWavefront(wavefront, scene, context.maxDepth, context.sortRays);
+		for (unsigned i = 0; i < wavefront.pixels.size(); i++)
+			writePixel(context, wavefront.pixels[i], wavefront.results[i]);
+		wavefront.pixels.clear();
+		wavefront.results.clear();
+	};
+
+	for (unsigned pass = 0; pass < accumulation.passes(); pass++)
 	{
-		for (unsigned tilex = tilesj * tilewidth; tilex < (tilesj * tilewidth) + tilewidth; tilex++)
-
-			//for (tiley = 0; tiley < 128; tiley++)
+		unsigned traced = 0;
+		for (unsigned p = 0; p < order.size(); p++)
 		{
-			pixelsprocessed++;
+			unsigned tilex = tile.x0 + order[p].x, tiley = tile.y0 + order[p].y;
+			if (tilex >= tile.x1 || tiley >= tile.y1) continue;
+			unsigned index = tilex + tiley * context.width;
+			if (!accumulation.needsSample(index, pass)) {
+				if (pass == 0) copyPixel(context, index);
+				continue;
+			}
+			traced++;
 
-			/*	tilex = rand() % width;
-				tiley = rand() % height;*/
+			// Each sample of a pixel is taken at a different point within it
+			float offsetx, offsety;
+			AccumulationBuffer::sampleOffset(accumulation.sampleCount(index), offsetx, offsety);
+			Vec3f raydir = context.camera.primaryRay(tilex + offsetx, tiley + offsety);
 
-				//std::cout << tiley << std::endl;
+			if (context.wavefront)
+			{
+				wavefront.addPrimary(index, context.camera.eye, raydir);
+				continue;
+			}
 
-				//float xx = (2 * ((tilex + 0.5) * invWidth) - 1) * angle * aspectratio;
-				//float yy = (1 - 2 * ((tiley + 0.5) * invHeight)) * angle;
+			if (context.packets)
+			{
+				packet.setRay(lanes, context.camera.eye, raydir);
+				packetpixels[lanes] = index;
+				if (++lanes == RayPacket::kSize) flushPacket();
+				continue;
+			}
 
-			float xx = (2 * ((tilex)* invWidth) - 1) * angle * aspectratio;
-			float yy = (1 - 2 * ((tiley)* invHeight)) * angle;
+			Vec3f traceresult = trace(context.camera.eye, raydir, scene, context.maxDepth);
 
-			Vec3f raydir(xx, yy, -1);
-			raydir.normalize();
+			writePixel(context, index, traceresult);
+		}
+		if (lanes > 0) flushPacket();
+		if (!wavefront.pixels.empty()) flushWavefront();
+		pixelsprocessed += traced;
+		if (traced == 0) break;
+	}
 
-			Vec3f rotation = Vec3f(0, -0.142612, 0);
-			//rotation = Vec3f(0, 0, -1).normalize();
-			raydir += rotation;
+	RayStats::add(kRayPrimary, pixelsprocessed);
 
+}
 
+// Split the image into tilesize x tilesize tiles, ordered in a spiral out from the centre
+// so the middle of the image is rendered first
+std::vector<Tile> makeTiles(unsigned width, unsigned height, unsigned tilesize)
+{
+	int tilesx = (width + tilesize - 1) / tilesize;
+	int tilesy = (height + tilesize - 1) / tilesize;
+	int centrex = (tilesx - 1) / 2, centrey = (tilesy - 1) / 2;
 
+	std::vector<Tile> tiles;
+	SpiralOut spiralgrid;
+	while (tiles.size() < unsigned(tilesx * tilesy))
+	{
+		int gridx = spiralgrid.x + centrex;
+		int gridy = spiralgrid.y + centrey;
+		spiralgrid.goNext();
+		if (gridx < 0 || gridy < 0 || gridx >= tilesx || gridy >= tilesy) continue;
+
+		Tile tile;
+		tile.x0 = gridx * tilesize;
+		tile.y0 = gridy * tilesize;
+		tile.x1 = std::min(tile.x0 + tilesize, width);
+		tile.y1 = std::min(tile.y0 + tilesize, height);
+		tiles.push_back(tile);
+	}
+	return tiles;
+}
+
+// Threads that render the tiles of a frame, the work-stealing scheduler unless a ctpl
+// pool was asked for
+struct TileWorkers
+{
+	TileScheduler* scheduler;
+	ctpl::thread_pool* pool;
+
+	unsigned size() const { return scheduler ? scheduler->size() : pool->size(); }
+};
 
+// Call work(tile, worker) for every tile on the workers, returning once all are done. Pool
+// tasks each hold their own copy of work, so whatever it owns lives until the last one ends.
+template<typename Work>
+void runTiles(TileWorkers &workers, const std::vector<Tile> &tiles, const Work &work)
+{
+	if (workers.scheduler) {
+		workers.scheduler->run(tiles, [&work](const Tile &tile, unsigned worker) { work(tile, worker); });
+		return;
+	}
+
+	std::vector<std::future<void>> tasks;
+	for (unsigned i = 0; i < tiles.size(); i++) {
+		const Tile &tile = tiles[i];
+		tasks.push_back(workers.pool->push([work, tile](int id) { work(tile, id); }));
+	}
+	for (unsigned i = 0; i < tasks.size(); i++)
+		tasks[i].get();
+}
 
-			//Vec3f traceresult = trace(Vec3f(50 + sin(float(totalframes) / 100) * 100, 273 + sin(float(totalframes)/100)*100, -10000), raydir, spheres, 0);
-			Vec3f traceresult = trace(Vec3f(sin(float(totalframes) / 250) * 50, 52, 295.6 + cos(float(totalframes) / 250) * 50    /* - (totalframes * 1)*/), raydir, scene, 0);
-			//Vec3f traceresult = trace(Vec3f(0, 52, 295.6), raydir, spheres, 0);
+// Camera for a frame, where the scene file put it or else orbiting slowly around the box
+Camera frameCamera(const Scene &scene, unsigned totalframes, unsigned width, unsigned height)
+{
+	if (scene.hasCamera) return Camera(scene.camera, width, height);
+	Vec3f eye(sin(float(totalframes) / 250) * 50, 52, 295.6 + cos(float(totalframes) / 250) * 50    /* - (totalframes * 1)*/);
+	return Camera(eye, Vec3f(0, -0.142612, 0), 70, width, height);
+}
 
-			//// Draw edge lines for each tile
-			//if (tiley == tilesi * tileheight)
-			//{
-			//	traceresult.x = 1.0;
-			//	traceresult.y = 0.0;
-			//	traceresult.z = 0.0;
-			//}
-			//if (tiley == (tilesi * tileheight) + tileheight - 1)
-			//{
-			//	traceresult.x = 0.0;
-			//	traceresult.y = 1.0;
-			//	traceresult.z = 0.0;
-			//}
+// Render every tile of one frame into the back buffers, returning once all of them are
+// finished. Samples are averaged with earlier frames while the camera and scene stay the same.
+// tiles and camera are for the framebuffer's render size, and frames traced below the output
+// size are upscaled into the back buffers. The finished image is then converted for display.
+// order is for the size of the tiles.
+void renderFrame(
+	TileWorkers &workers,
+	const std::vector<Tile> &tiles,
+	const PixelOrder &order,
+	const Scene &scene,
+	const Camera &camera,
+	Framebuffer &framebuffer,
+	AccumulationBuffer &accumulation,
+	unsigned totalframes,
+	const RenderOptions &options)
+{
+	accumulation.begin(camera, scene.version);
+	std::shared_ptr<const RenderContext> context = std::make_shared<const RenderContext>(scene, camera, totalframes,
+		framebuffer.renderWidth(), framebuffer.renderHeight(), options.packets, options.wavefront, options.sortRays, options.maxDepth,
+		order, framebuffer.renderImage(), &accumulation);
+	runTiles(workers, tiles, [context](const Tile &tile, unsigned worker) { threadedTrace(worker, *context, tile); });
+
+	runTiles(workers, framebuffer.bands(), [&framebuffer](const Tile &band, unsigned) {
+		if (framebuffer.scaled()) framebuffer.upscale(band);
+		framebuffer.display(band);
+	});
+}
 
+// Trace the coming frames at the size the scaler picked, remaking the tiles if it changed
+void applyRenderSize(const ResolutionScaler &scaler, Framebuffer &framebuffer, std::vector<Tile> &tiles, unsigned tilesize)
+{
+	if (scaler.width() == framebuffer.renderWidth() && scaler.height() == framebuffer.renderHeight() && !tiles.empty()) return;
+	framebuffer.setRenderSize(scaler.width(), scaler.height());
+	tiles = makeTiles(framebuffer.renderWidth(), framebuffer.renderHeight(), tilesize);
+}
 
-			//auto a = pixels + (tilex * 3 + tiley * width * 3); // this probbaly breaks shit
-			auto a = pixels + (tilex + tiley * width) * 3; // this probbaly breaks shit
-			auto b = a + 1;
-			auto c = b + 1;
+const char* schedulerName(const TileWorkers &workers)
+{
+	if (workers.scheduler) return "work stealing";
+	return workers.pool->is_lock_free() ? "ctpl pool, lock free queue" : "ctpl pool";
+}
 
-			*a = (unsigned char)(std::min(float(1), traceresult.x) * 255);
-			*b = (unsigned char)(std::min(float(1), traceresult.y) * 255);
-			*c = (unsigned char)(std::min(float(1), traceresult.z) * 255);
+// Render a fixed number of frames without a window, then write the last frame to disk
+bool renderHeadless(
+	TileWorkers &workers,
+	Scene &scene,
+	const RenderOptions &options,
+	Framebuffer &framebuffer,
+	AccumulationBuffer &accumulation)
+{
+	ResolutionScaler scaler(options.width, options.height, options.targetFps);
+	std::vector<Tile> tiles;
+	PixelOrder order(options.pixelOrder, options.tileSize);
+	std::vector<double> frametimes;
+	double updatetime = 0, maxupdatetime = 0;
+	float scalesum = 0, minscale = 1;
+
+	RayCounts before = RayStats::snapshot();
+	auto renderstart = std::chrono::high_resolution_clock::now();
+
+	for (unsigned totalframes = 0; totalframes < options.frames; totalframes++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		if (!options.still) {
+			scene.animate(totalframes);
+			double update = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000.0;
+			updatetime += update;
+			maxupdatetime = std::max(maxupdatetime, update);
 		}
-		//std::cout << tiley << std::endl;
+		applyRenderSize(scaler, framebuffer, tiles, options.tileSize);
+		scalesum += scaler.scale(), minscale = std::min(minscale, scaler.scale());
+		Camera camera = frameCamera(scene, options.still ? 0 : totalframes, framebuffer.renderWidth(), framebuffer.renderHeight());
+		renderFrame(workers, tiles, order, scene, camera, framebuffer, accumulation, totalframes, options);
+		framebuffer.swap();
+
+		auto finish = std::chrono::high_resolution_clock::now();
+		frametimes.push_back(std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() / 1000.0);
+		scaler.update(frametimes.back());
 	}
 
-	*totalrays += pixelsprocessed;
+	double totaltime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - renderstart).count() / 1000000.0;
+	RayCounts rays = RayStats::snapshot() - before;
+	double rps = totaltime > 0 ? rays.total() / totaltime : 0;
+	std::sort(frametimes.begin(), frametimes.end());
+	double averagetime = totaltime * 1000 / options.frames;
+
+	std::cout << "Rendered " << options.frames << " frames at " << options.width << "x" << options.height
+		<< " on " << workers.size() << " threads in " << totaltime << "s" << std::endl;
+	std::cout << "Tiles: " << tiles.size() << " of " << options.tileSize << "x" << options.tileSize
+		<< ", pixel order: " << PixelOrder::name(options.pixelOrder) << ", scheduler: " << schedulerName(workers) << std::endl;
+	std::cout << "Display: exposure " << options.exposure << ", tone curve " << Tonemap::name(options.toneCurve)
+		<< ", " << (options.srgb ? "sRGB" : "linear") << std::endl;
+	if (options.targetFps) {
+		std::cout << "Dynamic resolution for " << options.targetFps << " fps: scale avg " << scalesum / options.frames
+			<< ", min " << minscale << ", last " << framebuffer.renderWidth() << "x" << framebuffer.renderHeight() << std::endl;
+	}
+	std::cout << "Primary rays: " << (options.wavefront ? "wavefront" : options.packets ? "packets" : "single") << ", kernels: " << simdKernels().name << std::endl;
+	std::cout << "Total Rays: " << rays.total() << ", RPS: " << rps << ", ms/frame avg: " << averagetime
+		<< ", min: " << frametimes.front() << ", max: " << frametimes.back() << std::endl;
+	std::cout << "Rays:";
+	for (unsigned t = 0; t < kRayTypes; t++)
+		std::cout << " " << RayCounts::name(RayType(t)) << " " << rays.rays[t];
+	std::cout << ", intersection tests: " << rays.intersectionTests << ", node visits: " << rays.nodeVisits << std::endl;
+	if (rays.secondaryPackets) {
+		std::cout << "Secondary rays " << (options.sortRays ? "sorted" : "unsorted") << ": " << rays.secondaryPackets
+			<< " packets, octants per packet: " << rays.octantsPerPacket()
+			<< ", node visits per ray: " << double(rays.secondaryVisits) / (rays.rays[kRayReflection] + rays.rays[kRayRefraction]) << std::endl;
+	}
+	if (accumulation.threshold > 0) {
+		// Pixels are accumulated at the render size, which dynamic resolution may have lowered
+		double renderpixels = double(framebuffer.renderWidth()) * framebuffer.renderHeight();
+		std::cout << "Adaptive sampling: " << 100.0 * accumulation.convergedCount() / renderpixels
+			<< "% of pixels converged, primary rays per pixel: " << rays.rays[kRayPrimary] / renderpixels << std::endl;
+	}
+	if (scene.animatedCount()) {
+		std::cout << "Animated instances: " << scene.animatedCount() << ", BVH refits: " << scene.refits << ", rebuilds: " << scene.rebuilds
+			<< ", update ms/frame avg: " << updatetime / options.frames << ", max: " << maxupdatetime << std::endl;
+	}
 
+	bool written = writePPM(options.output + ".ppm", framebuffer.frontPixels(), options.width, options.height);
+	written = writePFM(options.output + ".pfm", framebuffer.frontImage(), options.width, options.height) && written;
+	if (!written) std::cout << "Failed to write " << options.output << ".ppm/.pfm" << std::endl;
+	return written;
 }
 
-void render(const std::vector<SceneObject*> &scene)
+// Render each built in scene for a fixed number of frames at a fixed size from a still
+// camera, so every run traces the same rays, and write the timings and ray counts to
+// output.json. Animated instances still move, since their refits are part of the cost.
+bool renderBenchmark(TileWorkers &workers, const RenderOptions &options)
 {
-	// Setup threadpool
-	ctpl::thread_pool p(2 /* two threads in the pool */);
+	const unsigned width = 640, height = 480, frames = 16;
+	const char* scenes[] = { "cornell", "mesh", "spheres", "instances" };
 
-	// Setup tracing properties
-	unsigned width = 1024, height = 768;
-	Vec3f *image = new Vec3f[width * height], *pixel = image;
-	float invWidth = 1 / float(width), invHeight = 1 / float(height);
-	float fov = 45, aspectratio = width / float(height);
-	float angle = tan(M_PI * 0.5 * fov / 180.);
+	BenchmarkSettings settings = { workers.size(), width, height, frames, options.tileSize,
+		simdKernels().name, schedulerName(workers), options.packets, options.wavefront, options.sortRays, options.maxDepth,
+		PixelOrder::name(options.pixelOrder) };
+	std::vector<Tile> tiles = makeTiles(width, height, options.tileSize);
+	PixelOrder order(options.pixelOrder, options.tileSize);
+	std::vector<BenchmarkResult> results;
+
+	for (unsigned s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++)
+	{
+		Scene scene;
+		if (s == 0) buildCornellScene(scene);
+		else if (s == 1) buildMeshScene(scene, 256);
+		else if (s == 2) buildSphereFieldScene(scene, 32);
+		else buildInstanceScene(scene, 16);
+		scene.rebuildCost = options.rebuildCost;
+		scene.build();
+
+		BenchmarkResult result;
+		result.scene = scenes[s];
+		result.primitives = scene.compiled.sphereCount() + scene.compiled.triangleCount() + scene.compiled.instanceCount();
+
+		Framebuffer framebuffer(width, height, options.tonemap());
+		AccumulationBuffer accumulation(width, height);
+		RayCounts before = RayStats::snapshot();
+		auto renderstart = std::chrono::high_resolution_clock::now();
+		for (unsigned totalframes = 0; totalframes < frames; totalframes++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			scene.animate(totalframes);
+			renderFrame(workers, tiles, order, scene, frameCamera(scene, 0, width, height), framebuffer, accumulation, totalframes, options);
+			framebuffer.swap();
+			auto finish = std::chrono::high_resolution_clock::now();
+			result.frametimes.push_back(std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() / 1000.0);
+		}
+		result.seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - renderstart).count() / 1000000.0;
+		result.rays = RayStats::snapshot() - before;
+		result.refits = scene.refits;
+		result.rebuilds = scene.rebuilds;
+
+		std::cout << result.scene << ": " << result.primitives << " primitives, RPS: " << result.raysPerSecond()
+			<< ", ms/frame p50: " << result.percentile(50) << ", p99: " << result.percentile(99) << std::endl;
+		results.push_back(result);
+	}
 
+	bool written = writeBenchmarkJSON(options.output + ".json", settings, results);
+	if (!written) std::cout << "Failed to write " << options.output << ".json" << std::endl;
+	return written;
+}
 
+#ifndef RAYTRACER_NO_SDL
+// Render continuously into an SDL window. Each frame is shown once all of its tiles are
+// done, while the next one is traced into the back buffers.
+bool renderInteractive(
+	TileWorkers &workers,
+	Scene &scene,
+	const RenderOptions &options,
+	Framebuffer &framebuffer,
+	AccumulationBuffer &accumulation)
+{
+	unsigned width = options.width, height = options.height;
+	int channels = Framebuffer::kChannels; // for a RGB image
 
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 		std::cout << "SDL_Init Error: " << SDL_GetError() << std::endl;
-		return;
+		return false;
 	}
 
 	SDL_Window *window = SDL_CreateWindow("Hello World!", 100, 100, width, height,
 		SDL_WINDOW_SHOWN);
 	if (window == NULL) {
 		std::cout << "SDL_CreateWindow Error: " << SDL_GetError() << std::endl;
-		return;
+		return false;
 	}
 
-
-	int channels = 3; // for a RGB image
-	char* pixels = new char[width * height * channels];
-
-	// Total rays atomic store
-	std::atomic<int>* totalrays = new std::atomic<int>;
-	totalrays->store(0);
-
 	unsigned totalframes = 0;
+	ResolutionScaler scaler(width, height, options.targetFps ? options.targetFps : kInteractiveFps);
+	std::vector<Tile> tiles;
+	PixelOrder order(options.pixelOrder, options.tileSize);
 
+	RayCounts before = RayStats::snapshot();
 	auto renderstart = std::chrono::high_resolution_clock::now();
 
-	while (true)
-	{
-		unsigned targetfps = 60;
-		float framenanos = 1000000000 / targetfps;
-
-		unsigned rays = 0;
-		unsigned raysperbatch = 5000;
-
+	// Frames are traced at whatever size keeps up with the target frame rate
+	auto traceFrame = [&]() {
 		auto start = std::chrono::high_resolution_clock::now();
-		auto finish = std::chrono::high_resolution_clock::now();
-
-		while (std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count() <= framenanos)
-		{
-			/*if (totalrays >= 100)
-				break;*/
-				//std::cout << std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count() << " : " << frame_nanos << std::endl;
-
-			unsigned tiles = 5;
+		if (!options.still) scene.animate(totalframes);
+		applyRenderSize(scaler, framebuffer, tiles, options.tileSize);
+		Camera camera = frameCamera(scene, options.still ? 0 : totalframes, framebuffer.renderWidth(), framebuffer.renderHeight());
+		renderFrame(workers, tiles, order, scene, camera, framebuffer, accumulation, totalframes, options);
+		scaler.update(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000.0);
+	};
+
+	traceFrame();
+	framebuffer.swap();
+	totalframes++;
+	// Size of the frame on screen. The next frame resizes the framebuffer while it is traced,
+	// so it is only read here between frames.
+	unsigned shownwidth = framebuffer.renderWidth(), shownheight = framebuffer.renderHeight();
+	// The next frame is traced on one long lived thread while this one is shown, so no
+	// thread is started per frame
+	ctpl::thread_pool framethread(1);
 
-			int gridoffset = tiles % 2 == 0 ? 1 : 0;
-
-			SpiralOut spiralgrid;
-			if (p.n_pending() <= tiles * tiles)
-			{
-				for (unsigned i = 0; i < tiles*tiles; i++)
-				{
-					int gridx = spiralgrid.x + tiles / 2 - gridoffset;
-					int gridy = spiralgrid.y + tiles / 2 - gridoffset;
-
-					p.push(threadedTrace, Vec3f(0, sin(float(totalframes) / 250), 0), scene, 0, pixels, totalrays, totalframes, width, height, raysperbatch, tiles, gridx, gridy);
-
-					spiralgrid.goNext();
-				}
-			}
-
-			finish = std::chrono::high_resolution_clock::now();
-		}
-		totalframes++;
+	while (true)
+	{
+		std::future<void> nextframe = framethread.push([&traceFrame](int) { traceFrame(); });
 
 		if (totalframes % 15 == 0)
 		{
-			float rps = (float(totalrays->load()) / std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - renderstart).count()) * 1000000000;
+			uint64_t totalrays = (RayStats::snapshot() - before).total();
+			float rps = (float(totalrays) / std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - renderstart).count()) * 1000000000;
 			auto totaltime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - renderstart).count() / 1000000000;
 			auto fps = totaltime <= 0 ? 0 : totalframes / totaltime;
-			std::cout << "Finished Frame, Total Rays: " << totalrays->load() << ", RPS: " << rps << ", FPS: " << fps << ", Time: " << totaltime << std::endl;
-			std::cout << "Waiting Threads: " << p.n_pending() << std::endl;
+			std::cout << "Finished Frame, Total Rays: " << totalrays << ", RPS: " << rps << ", FPS: " << fps << ", Time: " << totaltime << std::endl;
+			std::cout << "Render Threads: " << workers.size() << ", render size: " << shownwidth << "x" << shownheight << std::endl;
 		}
 
 
 
-		SDL_Surface *surface = SDL_CreateRGBSurfaceFrom((void*)pixels,
+		SDL_Surface *surface = SDL_CreateRGBSurfaceFrom((void*)framebuffer.frontPixels(),
 			width,
 			height,
 			channels * 8,          // bits per pixel = 24
@@ -372,6 +841,7 @@ void render(const std::vector<SceneObject*> &scene)
 			NULL,
 			surface_window,
 			NULL);
+		SDL_FreeSurface(surface);
 
 		/*
 		* Now updating the window
@@ -390,6 +860,11 @@ void render(const std::vector<SceneObject*> &scene)
 		while (SDL_PollEvent(&event)) {
 			/* handle your event here */
 		}
+
+		nextframe.get();
+		framebuffer.swap();
+		totalframes++;
+		shownwidth = framebuffer.renderWidth(), shownheight = framebuffer.renderHeight();
 	}
 
 	/*    SDL_DestroyTexture(tex);*/
@@ -397,35 +872,91 @@ void render(const std::vector<SceneObject*> &scene)
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 
+	return true;
 }
+#endif
 
-
-int main(int argc, char *args[])
+bool render(Scene &scene, const RenderOptions &options)
 {
-	srand(13);
-	std::vector<SceneObject*> scene;
+	// Setup the render threads, one per hardware thread unless told otherwise
+	unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	std::unique_ptr<TileScheduler> scheduler;
+	std::unique_ptr<ctpl::thread_pool> pool;
+	if (options.pool) {
+		pool.reset(new ctpl::thread_pool(threads, options.lockFree ? ctpl::queue_type::lock_free : ctpl::queue_type::locked));
+		pool->set_spin_count(1000); // tiles are short, so the next one usually arrives before a thread would sleep
+	}
+	else scheduler.reset(new TileScheduler(threads));
+	TileWorkers workers = { scheduler.get(), pool.get() };
 
-	// Camera is at Vec3f(50, 273, -10000)
+	// Setup tracing properties
+	Framebuffer framebuffer(options.width, options.height, options.tonemap());
+	AccumulationBuffer accumulation(options.width, options.height, options.adaptive);
 
-	scene.push_back(new Sphere(Vec3f(-1e5 - 100, 40.8, 81.6), 1e5, Vec3f(0.75, 0.25, 0.25), 0, 0.0, Vec3f(0))); // Left
-	scene.push_back(new Sphere(Vec3f(1e5 + 100, 40.8, 81.6), 1e5, Vec3f(0.25, 0.25, 0.75), 0, 0.0, Vec3f(0))); // Right
-	scene.push_back(new Sphere(Vec3f(0, 40.8, -1e5 - 81.6), 1e5, Vec3f(0.25, 0.25, 0.25), 1.0, 0.0, Vec3f(0.0))); // Back
-	scene.push_back(new Sphere(Vec3f(0, 40.8, 1e5 + 81.6), 1e5, Vec3f(0.75, 0.75, 0.75), 0, 0.0, Vec3f(0.0))); // Front
-	scene.push_back(new Sphere(Vec3f(0, 1e5 + 120.6, 81.6), 1e5, Vec3f(0.75, 0.25, 0.75), 0, 0.0, Vec3f(0.0, 0.0, 0.0))); // Top
-	scene.push_back(new Sphere(Vec3f(0, -1e5 - 60.8, 81.6), 1e5, Vec3f(0.75, 0.75, 0.25), 0, 0.0, Vec3f(0, 0, 0))); // Bottom
+	bool result = false;
+	if (options.benchmark) {
+		result = renderBenchmark(workers, options);
+	}
+	else if (options.headless) {
+		result = renderHeadless(workers, scene, options, framebuffer, accumulation);
+	}
+	else {
+#ifndef RAYTRACER_NO_SDL
+		result = renderInteractive(workers, scene, options, framebuffer, accumulation);
+#else
+		std::cout << "Built without SDL, only --headless rendering is available" << std::endl;
+#endif
+	}
 
-	// Spheres in box
-	scene.push_back(new Sphere(Vec3f(-50, 16.5, 77), 1, Vec3f(1.0, 1.0, 1.0), 1.0, 0.0, Vec3f(0.0), Material())); // Mirror
-	scene.push_back(new Sphere(Vec3f(50, 16.5, 78), 4.5, Vec3f(1.0, 1.0, 1.0), 0, 1, Vec3f(0.0), Material())); // Glass
+	if (pool) pool->stop(true);
+	scheduler.reset();
+	return result;
+}
 
-	scene.push_back(new Sphere(Vec3f(0, 80.6, 50), 1, Vec3f(1.0, 1.0, 1.0), 1.0, 0, Vec3f(1, 1, 1))); // Light
 
-	// Triangle
-	scene.push_back(new Triangle(Vec3f(90, 30, 10), Vec3f(10, 50, -30), Vec3f(10, -30, 70), Vec3f(0.2, 1.0, 0.2), 0, 0, Vec3f(1.0, 1.0, 1.0)));
+int main(int argc, char *args[])
+{
+	RenderOptions options;
+	if (!options.parse(argc, args)) {
+		RenderOptions::usage(args[0]);
+		return 1;
+	}
 
+	selectSimdKernels(options.simd);
+
+	// Load or build the scene and its acceleration structure once, before any rays are traced.
+	// A compiled cache is used as it is, anything else is built.
+	Scene scene;
+	scene.rebuildCost = options.rebuildCost;
+	auto loadstart = std::chrono::high_resolution_clock::now();
+	if (options.benchmark) scene.build();
+	else if (options.scene.empty()) {
+		buildCornellScene(scene);
+		scene.build();
+	}
+	else if (SceneCache::detect(options.scene)) {
+		if (!SceneCache::load(options.scene, scene)) {
+			std::cout << options.scene << " is not a scene cache this build can read, compile it again" << std::endl;
+			return 1;
+		}
+	}
+	else {
+		if (!SceneFile::load(options.scene, scene)) return 1;
+		scene.build();
+	}
+	if (!options.scene.empty()) {
+		double loadtime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - loadstart).count() / 1000.0;
+		std::cout << "Loaded " << options.scene << " in " << loadtime << "ms: " << scene.compiled.sphereCount() << " spheres, "
+			<< scene.compiled.triangleCount() << " triangles, " << scene.compiled.instanceCount() << " instances, "
+			<< scene.lights.size() << " lights" << std::endl;
+	}
 
-	render(scene);
+	if (!options.compile.empty()) {
+		bool written = SceneCache::write(options.compile, scene);
+		if (!written) std::cout << "Failed to write " << options.compile << std::endl;
+		return written ? 0 : 1;
+	}
 
-	return 0;
+	return render(scene, options) ? 0 : 1;
 }
 
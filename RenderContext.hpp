@@ -0,0 +1,38 @@
+#pragma once
+#include "Vec3.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "AccumulationBuffer.hpp"
+#include "PixelOrder.hpp"
+
+// Everything the tiles of one frame share: the scene, the camera and the frame settings,
+// plus where to write the results. Built once per frame and held through a shared_ptr,
+// so tile tasks only take a reference and nothing per tile is copied or allocated. Pool
+// tasks keep a copy of the pointer, so the context lives until the frame's last tile is done.
+class RenderContext
+{
+public:
+	const Scene &scene;
+	const Camera camera;
+	const unsigned frame;
+	const unsigned width, height;
+	const bool packets;                     /// trace primary and shadow rays in packets
+	const bool wavefront;                   /// trace tiles a stage at a time over queues of rays
+	const bool sortRays;                    /// sort the wavefront's secondary rays for coherence
+	const unsigned maxDepth;                /// reflection and refraction bounces to follow after the primary hit
+	const PixelOrder &order;                /// order the pixels of each tile are traced in
+	Vec3f* const image;                     /// linear float output, converted for display once the frame is done
+	AccumulationBuffer* const accumulation; /// samples of earlier frames, averaged into the output
+
+	RenderContext(const Scene &scene, const Camera &camera, unsigned frame, unsigned width, unsigned height,
+		bool packets, bool wavefront, bool sortRays, unsigned maxDepth,
+		const PixelOrder &order, Vec3f* image, AccumulationBuffer* accumulation)
+		: scene(scene), camera(camera), frame(frame), width(width), height(height),
+		packets(packets), wavefront(wavefront), sortRays(sortRays), maxDepth(maxDepth), order(order), image(image), accumulation(accumulation)
+	{
+	}
+
+private:
+	RenderContext(const RenderContext &);
+	RenderContext & operator=(const RenderContext &);
+};
@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "SIMD.hpp"
+#include "PixelOrder.hpp"
+#include "Tonemap.hpp"
+
+const unsigned kInteractiveFps = 60;        /// frame rate windowed rendering holds unless told otherwise
+const unsigned kMaxRayDepth = 16;           /// deepest --max-depth, sizes the stack of pending rays in shade()
+
+// Command line settings for a render. Interactive (SDL window) rendering is the default,
+// --headless renders a fixed number of frames to disk and exits.
+class RenderOptions
+{
+public:
+	bool headless = false;
+	bool benchmark = false;                 /// render the built in scenes and write timings to output.json
+	unsigned frames = 1;                    /// frames to render in headless mode
+	std::string output = "render";          /// output path without extension, .ppm and .pfm (or .json) are written
+	unsigned width = 1024, height = 768;
+	bool packets = true;                    /// trace primary and shadow rays in packets
+	bool wavefront = false;                 /// trace each tile a stage at a time over queues of rays, always in packets
+	bool sortRays = false;                  /// sort secondary rays by direction and origin before tracing them, implies wavefront
+	unsigned maxDepth = 5;                  /// reflection and refraction bounces to follow, at most kMaxRayDepth
+	SimdLevel simd = kSimdAuto;             /// widest packet kernels to use
+	unsigned threads = 0;                   /// render threads, 0 for one per hardware thread
+	unsigned tileSize = 64;                 /// width and height of a tile in pixels, at most PixelOrder::kMaxTileSize
+	PixelCurve pixelOrder = kCurveScanline; /// order the pixels within a tile are traced in
+	bool pool = false;                      /// render tiles on the ctpl pool instead of the work-stealing scheduler
+	bool lockFree = false;                  /// give the ctpl pool its lock free queue
+	bool still = false;                     /// hold the camera still so frames accumulate into one image
+	float adaptive = 0;                     /// error at which accumulated pixels stop being sampled, 0 samples them all, implies still
+	unsigned targetFps = 0;                 /// lower the render resolution to hold this frame rate, 0 for kInteractiveFps in a window and full resolution headless
+	float exposure = 0;                     /// stops to scale the image by before display
+	ToneCurve toneCurve = kToneClamp;       /// how values above 1 are displayed
+	bool srgb = true;                       /// encode displayed and .ppm pixels as sRGB rather than linear
+	std::string scene;                      /// text scene or compiled scene cache, the built in box if empty
+	std::string compile;                    /// write the scene as a compiled cache to this path and exit
+	float rebuildCost = 1.5f;               /// see Scene::rebuildCost
+
+	// Returns false if the arguments could not be parsed
+	bool parse(int argc, char *args[])
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = args[i];
+			bool hasvalue = i + 1 < argc;
+			if (strcmp(arg, "--headless") == 0) headless = true;
+			else if (strcmp(arg, "--benchmark") == 0) benchmark = true;
+			else if (strcmp(arg, "--frames") == 0 && hasvalue) frames = (unsigned)atoi(args[++i]);
+			else if (strcmp(arg, "--output") == 0 && hasvalue) output = args[++i];
+			else if (strcmp(arg, "--width") == 0 && hasvalue) width = (unsigned)atoi(args[++i]);
+			else if (strcmp(arg, "--height") == 0 && hasvalue) height = (unsigned)atoi(args[++i]);
+			else if (strcmp(arg, "--no-packets") == 0) packets = false;
+			else if (strcmp(arg, "--wavefront") == 0) wavefront = true;
+			else if (strcmp(arg, "--sort-rays") == 0) sortRays = wavefront = true;
+			else if (strcmp(arg, "--max-depth") == 0 && hasvalue) maxDepth = (unsigned)atoi(args[++i]);
+			else if (strcmp(arg, "--still") == 0) still = true;
+			else if (strcmp(arg, "--adaptive") == 0 && hasvalue) adaptive = (float)atof(args[++i]);
+			else if (strcmp(arg, "--target-fps") == 0 && hasvalue) targetFps = (unsigned)atoi(args[++i]);
+			else if (strcmp(arg, "--threads") == 0 && hasvalue) threads = (unsigned)atoi(args[++i]);
+			else if (strcmp(arg, "--tile-size") == 0 && hasvalue) tileSize = (unsigned)atoi(args[++i]);
+			else if (strcmp(arg, "--scene") == 0 && hasvalue) scene = args[++i];
+			else if (strcmp(arg, "--compile") == 0 && hasvalue) compile = args[++i];
+			else if (strcmp(arg, "--rebuild-cost") == 0 && hasvalue) rebuildCost = (float)atof(args[++i]);
+			else if (strcmp(arg, "--scheduler") == 0 && hasvalue) {
+				const char* scheduler = args[++i];
+				if (strcmp(scheduler, "steal") == 0) pool = false, lockFree = false;
+				else if (strcmp(scheduler, "pool") == 0) pool = true, lockFree = false;
+				else if (strcmp(scheduler, "lockfree") == 0) pool = true, lockFree = true;
+				else {
+					std::cout << "Unknown scheduler: " << scheduler << std::endl;
+					return false;
+				}
+			}
+			else if (strcmp(arg, "--pixel-order") == 0 && hasvalue) {
+				const char* curve = args[++i];
+				if (strcmp(curve, "scanline") == 0) pixelOrder = kCurveScanline;
+				else if (strcmp(curve, "morton") == 0) pixelOrder = kCurveMorton;
+				else if (strcmp(curve, "hilbert") == 0) pixelOrder = kCurveHilbert;
+				else {
+					std::cout << "Unknown pixel order: " << curve << std::endl;
+					return false;
+				}
+			}
+			else if (strcmp(arg, "--exposure") == 0 && hasvalue) exposure = (float)atof(args[++i]);
+			else if (strcmp(arg, "--no-srgb") == 0) srgb = false;
+			else if (strcmp(arg, "--tonemap") == 0 && hasvalue) {
+				const char* curve = args[++i];
+				if (strcmp(curve, "clamp") == 0) toneCurve = kToneClamp;
+				else if (strcmp(curve, "reinhard") == 0) toneCurve = kToneReinhard;
+				else {
+					std::cout << "Unknown tone curve: " << curve << std::endl;
+					return false;
+				}
+			}
+			else if (strcmp(arg, "--simd") == 0 && hasvalue) {
+				const char* level = args[++i];
+				if (strcmp(level, "scalar") == 0) simd = kSimdScalar;
+				else if (strcmp(level, "sse") == 0) simd = kSimdSSE;
+				else if (strcmp(level, "avx2") == 0) simd = kSimdAVX2;
+				else if (strcmp(level, "auto") == 0) simd = kSimdAuto;
+				else {
+					std::cout << "Unknown SIMD level: " << level << std::endl;
+					return false;
+				}
+			}
+			else {
+				std::cout << "Unknown or incomplete argument: " << arg << std::endl;
+				return false;
+			}
+		}
+		// Pixels need several accumulated samples before they can converge, which a moving camera never gives them
+		if (adaptive > 0) still = true;
+		if (frames == 0 || width == 0 || height == 0 || tileSize == 0) {
+			std::cout << "Frames, width, height and tile size must be positive" << std::endl;
+			return false;
+		}
+		if (tileSize > PixelOrder::kMaxTileSize) {
+			std::cout << "Tile size must be at most " << unsigned(PixelOrder::kMaxTileSize) << std::endl;
+			return false;
+		}
+		if (maxDepth > kMaxRayDepth) {
+			std::cout << "Max depth must be at most " << kMaxRayDepth << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	Tonemap tonemap() const { return Tonemap(exposure, toneCurve, srgb); }
+
+	static void usage(const char* program)
+	{
+		std::cout << "Usage: " << program << " [--headless | --benchmark] [--frames N] [--output path] [--width W] [--height H]"
+			<< " [--scene path] [--compile path] [--rebuild-cost R] [--no-packets] [--wavefront] [--sort-rays] [--max-depth N] [--still] [--adaptive E] [--target-fps N] [--exposure EV] [--tonemap clamp|reinhard] [--no-srgb] [--simd scalar|sse|avx2|auto] [--threads N] [--tile-size N] [--pixel-order scanline|morton|hilbert] [--scheduler steal|pool|lockfree]" << std::endl;
+	}
+};
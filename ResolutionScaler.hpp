@@ -0,0 +1,49 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+// Picks the resolution to trace frames at so they keep up with a target frame rate, as a
+// fraction of the output size that frames are then upscaled to. Tracing time grows with
+// the number of pixels, so the scaler keeps a smoothed cost per pixel from the frames it is
+// told about and sizes the next frame to fit the frame budget, less some headroom. Sizes
+// move in steps and only when the budget is missed or comfortably beaten, since every
+// change restarts accumulation.
+class ResolutionScaler
+{
+public:
+	static constexpr float kMinScale = 0.25f;   /// smallest fraction of the output width and height
+	static constexpr float kStep = 1.0f / 32;   /// scales are multiples of this
+	static constexpr float kHeadroom = 0.9f;    /// fraction of the frame budget to aim for
+	static constexpr float kSmoothing = 0.3f;   /// weight of the latest frame in the cost estimate
+
+	const unsigned outputWidth, outputHeight;
+
+	// targetfps 0 always traces at the output size
+	ResolutionScaler(unsigned width, unsigned height, unsigned targetfps)
+		: outputWidth(width), outputHeight(height), budget(targetfps ? 1000.0 / targetfps : 0), current(1), cost(0)
+	{
+	}
+
+	float scale() const { return current; }
+	unsigned width() const { return std::max(1u, (unsigned)std::lround(outputWidth * current)); }
+	unsigned height() const { return std::max(1u, (unsigned)std::lround(outputHeight * current)); }
+
+	// Account for a frame traced at the current size in milliseconds and choose the next size
+	void update(double milliseconds)
+	{
+		if (budget <= 0) return;
+		double pixelcost = milliseconds / (double(width()) * height());
+		cost = cost > 0 ? cost + kSmoothing * (pixelcost - cost) : pixelcost;
+
+		double predicted = cost * width() * height();
+		if (predicted <= budget && predicted >= budget * kHeadroom * kHeadroom) return;
+		double fit = std::sqrt(budget * kHeadroom / (cost * outputWidth * outputHeight));
+		float next = std::floor(float(fit) / kStep) * kStep;
+		current = std::max(float(kMinScale), std::min(1.0f, next));
+	}
+
+private:
+	double budget;                          /// milliseconds per frame
+	float current;
+	double cost;                            /// smoothed milliseconds per traced pixel
+};
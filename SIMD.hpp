@@ -0,0 +1,232 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "Vec3.hpp"
+#include "AABB.hpp"
+#include "RayPacket.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RAYTRACER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RT_TARGET_SSE
+#define RT_TARGET_AVX2
+#else
+#define RT_TARGET_SSE __attribute__((target("sse2")))
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+constexpr float kEpsilon = 1e-8;            /// minimum determinant for a ray to hit a triangle
+
+enum SimdLevel
+{
+	kSimdScalar,
+	kSimdSSE,                               /// 4 rays per instruction
+	kSimdAVX2,                              /// 8 rays per instruction
+	kSimdAuto                               /// widest level the CPU supports
+};
+
+// Views of the structure of arrays primitive storage in CompiledScene. Arrays are padded so
+// a full SIMD width can always be loaded from any primitive.
+struct SphereArrays
+{
+	const float *x, *y, *z, *radius2;
+};
+
+struct TriangleArrays
+{
+	const float *ax, *ay, *az;               /// first vertex
+	const float *abx, *aby, *abz;            /// edge from the first to the second vertex
+	const float *acx, *acy, *acz;            /// edge from the first to the third vertex
+};
+
+// Intersection kernels for one instruction set, selected at runtime by simdKernels().
+// The packet kernels test many rays against one primitive, the others one ray against
+// a contiguous range of primitives.
+struct SimdKernels
+{
+	const char* name;
+	unsigned (*intersectBox)(const RayPacket &packet, unsigned lanes, const AABB &box, float &tentry);
+	void (*intersectSphere)(RayPacket &packet, const Vec3f &center, float radius2, unsigned primitive);
+	void (*occludedSphere)(RayPacket &packet, const Vec3f &center, float radius2);
+	void (*intersectTriangle)(RayPacket &packet, const Vec3f &a, const Vec3f &ab, const Vec3f &ac, unsigned primitive);
+	void (*occludedTriangle)(RayPacket &packet, const Vec3f &a, const Vec3f &ab, const Vec3f &ac);
+	void (*intersectSpheres)(const SphereArrays &spheres, unsigned first, unsigned count,
+		const Vec3f &rayorig, const Vec3f &raydir, float &tnear, unsigned &primitive);
+	bool (*occludedSpheres)(const SphereArrays &spheres, unsigned first, unsigned count,
+		const Vec3f &rayorig, const Vec3f &raydir, float tmax);
+	void (*intersectTriangles)(const TriangleArrays &triangles, unsigned first, unsigned count,
+		const Vec3f &rayorig, const Vec3f &raydir, float &tnear, unsigned &primitive);
+	bool (*occludedTriangles)(const TriangleArrays &triangles, unsigned first, unsigned count,
+		const Vec3f &rayorig, const Vec3f &raydir, float tmax);
+	void (*tonemap)(const float* in, unsigned char* out, unsigned count, float scale, bool reinhard,
+		float quantise, float offset, const unsigned char* lut);
+};
+
+namespace scalar {
+	typedef float vfloat;
+	typedef bool vmask;
+	static const unsigned kWidth = 1;
+#define RT_KERNEL inline
+	inline vfloat vset1(float f) { return f; }
+	inline vfloat vload(const float* p) { return *p; }
+	inline vfloat vloadu(const float* p) { return *p; }
+	inline void vstore(float* p, vfloat a) { *p = a; }
+	inline void vstoretrunc(int* p, vfloat a) { *p = int(a); }
+	inline void vstorebytes(unsigned char* p, vfloat a) { *p = (unsigned char)int(a); }
+	inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+	inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+	inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+	inline vfloat vdiv(vfloat a, vfloat b) { return a / b; }
+	inline vfloat vsqrt(vfloat a) { return std::sqrt(a); }
+	inline vfloat vmin(vfloat a, vfloat b) { return a < b ? a : b; }
+	inline vfloat vmax(vfloat a, vfloat b) { return a > b ? a : b; }
+	inline vmask vcmplt(vfloat a, vfloat b) { return a < b; }
+	inline vmask vcmple(vfloat a, vfloat b) { return a <= b; }
+	inline vmask vcmpge(vfloat a, vfloat b) { return a >= b; }
+	inline vmask vand(vmask a, vmask b) { return a && b; }
+	inline vfloat vselect(vmask m, vfloat a, vfloat b) { return m ? a : b; }
+	inline unsigned vmovemask(vmask m) { return m ? 1u : 0u; }
+#include "SimdKernels.inl"
+#undef RT_KERNEL
+}
+
+#ifdef RAYTRACER_X86
+namespace sse {
+	typedef __m128 vfloat;
+	typedef __m128 vmask;
+	static const unsigned kWidth = 4;
+#define RT_KERNEL RT_TARGET_SSE inline
+	RT_KERNEL vfloat vset1(float f) { return _mm_set1_ps(f); }
+	RT_KERNEL vfloat vload(const float* p) { return _mm_load_ps(p); }
+	RT_KERNEL vfloat vloadu(const float* p) { return _mm_loadu_ps(p); }
+	RT_KERNEL void vstore(float* p, vfloat a) { _mm_store_ps(p, a); }
+	RT_KERNEL void vstoretrunc(int* p, vfloat a) { _mm_store_si128((__m128i*)p, _mm_cvttps_epi32(a)); }
+	RT_KERNEL void vstorebytes(unsigned char* p, vfloat a)
+	{
+		__m128i i = _mm_cvttps_epi32(a);
+		i = _mm_packs_epi32(i, i);
+		int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+		memcpy(p, &bytes, sizeof(bytes));
+	}
+	RT_KERNEL vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+	RT_KERNEL vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+	RT_KERNEL vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+	RT_KERNEL vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+	RT_KERNEL vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+	RT_KERNEL vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+	RT_KERNEL vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+	RT_KERNEL vmask vcmplt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+	RT_KERNEL vmask vcmple(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+	RT_KERNEL vmask vcmpge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+	RT_KERNEL vmask vand(vmask a, vmask b) { return _mm_and_ps(a, b); }
+	RT_KERNEL vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+	RT_KERNEL unsigned vmovemask(vmask m) { return (unsigned)_mm_movemask_ps(m); }
+#include "SimdKernels.inl"
+#undef RT_KERNEL
+}
+
+namespace avx2 {
+	typedef __m256 vfloat;
+	typedef __m256 vmask;
+	static const unsigned kWidth = 8;
+#define RT_KERNEL RT_TARGET_AVX2 inline
+	RT_KERNEL vfloat vset1(float f) { return _mm256_set1_ps(f); }
+	RT_KERNEL vfloat vload(const float* p) { return _mm256_load_ps(p); }
+	RT_KERNEL vfloat vloadu(const float* p) { return _mm256_loadu_ps(p); }
+	RT_KERNEL void vstore(float* p, vfloat a) { _mm256_store_ps(p, a); }
+	RT_KERNEL void vstoretrunc(int* p, vfloat a) { _mm256_store_si256((__m256i*)p, _mm256_cvttps_epi32(a)); }
+	RT_KERNEL void vstorebytes(unsigned char* p, vfloat a)
+	{
+		__m256i i = _mm256_cvttps_epi32(a);
+		__m128i words = _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1));
+		_mm_storel_epi64((__m128i*)p, _mm_packus_epi16(words, words));
+	}
+	RT_KERNEL vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+	RT_KERNEL vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+	RT_KERNEL vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+	RT_KERNEL vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+	RT_KERNEL vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+	RT_KERNEL vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+	RT_KERNEL vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+	RT_KERNEL vmask vcmplt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	RT_KERNEL vmask vcmple(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	RT_KERNEL vmask vcmpge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	RT_KERNEL vmask vand(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+	RT_KERNEL vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+	RT_KERNEL unsigned vmovemask(vmask m) { return (unsigned)_mm256_movemask_ps(m); }
+#include "SimdKernels.inl"
+#undef RT_KERNEL
+}
+#endif
+
+// Widest instruction set supported by both the CPU and the operating system
+inline SimdLevel detectSimdLevel()
+{
+#if defined(RAYTRACER_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxleaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+	if (avx && maxleaf >= 7) {
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5)) return kSimdAVX2;
+	}
+	return sse2 ? kSimdSSE : kSimdScalar;
+#elif defined(RAYTRACER_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return kSimdAVX2;
+	if (__builtin_cpu_supports("sse2")) return kSimdSSE;
+	return kSimdScalar;
+#else
+	return kSimdScalar;
+#endif
+}
+
+#define RT_KERNEL_TABLE(isa) { #isa, isa::intersectBoxPacket, \
+	isa::intersectSpherePacket, isa::occludedSpherePacket, \
+	isa::intersectTrianglePacket, isa::occludedTrianglePacket, \
+	isa::intersectSpheres, isa::occludedSpheres, \
+	isa::intersectTriangles, isa::occludedTriangles, isa::tonemap }
+
+inline const SimdKernels &simdKernelsFor(SimdLevel level)
+{
+	static const SimdKernels scalarkernels = RT_KERNEL_TABLE(scalar);
+#ifdef RAYTRACER_X86
+	static const SimdKernels ssekernels = RT_KERNEL_TABLE(sse);
+	static const SimdKernels avx2kernels = RT_KERNEL_TABLE(avx2);
+	if (level == kSimdAVX2) return avx2kernels;
+	if (level == kSimdSSE) return ssekernels;
+#endif
+	return scalarkernels;
+}
+
+#undef RT_KERNEL_TABLE
+
+inline const SimdKernels* &simdKernelSlot()
+{
+	static const SimdKernels* kernels = &simdKernelsFor(detectSimdLevel());
+	return kernels;
+}
+
+// Kernels used for tracing, the widest supported set unless overridden
+inline const SimdKernels &simdKernels()
+{
+	return *simdKernelSlot();
+}
+
+// Select the kernels to use, falling back to the widest supported level below the one
+// requested. Call before any rendering threads start.
+inline const SimdKernels &selectSimdKernels(SimdLevel requested)
+{
+	SimdLevel supported = detectSimdLevel();
+	SimdLevel level = requested == kSimdAuto ? supported : std::min(requested, supported);
+	simdKernelSlot() = &simdKernelsFor(level);
+	return simdKernels();
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+#include "Vec3.hpp"
+#include "Camera.hpp"
+#include "SceneObject.hpp"
+#include "CompiledScene.hpp"
+#include "Instance.hpp"
+#include "TriangleMesh.hpp"
+#include "RayPacket.hpp"
+#include "SIMD.hpp"
+
+// Owns the scene objects along with the compiled primitives and acceleration structure
+// built from them. build() must be called once, after the last object is added and before
+// rendering. Hits are reported as CompiledScene primitive ids.
+class Scene
+{
+public:
+	std::vector<SceneObject*> objects;
+	std::vector<const SceneObject*> lights;  /// emissive objects, gathered by build()
+	CompiledScene compiled;
+	unsigned version = 0;                    /// incremented by every build(), so renderers can tell the scene changed
+	bool hasCamera = false;                  /// set by scene files, otherwise the camera orbits the box
+	CameraPlacement camera;
+	float rebuildCost = 1.5f;                /// rebuild once refits make the BVH's SAH cost this many times worse
+	unsigned refits = 0, rebuilds = 0;       /// BVH updates made by animate()
+
+	Scene() {}
+	~Scene()
+	{
+		for (unsigned i = 0; i < objects.size(); ++i)
+			delete objects[i];
+	}
+
+	void add(SceneObject* object) { objects.push_back(object); }
+
+	void build()
+	{
+		gatherLights();
+		compiled.clear();
+		for (unsigned i = 0; i < objects.size(); ++i)
+			objects[i]->compile(compiled);
+		compiled.build();
+		releaseMeshes();
+		findAnimated();
+		version++;
+	}
+
+	// Render arrays compiled earlier, such as ones mapped from a scene cache, instead of
+	// compiling the objects, which are then only used as lights. geometries are placed by
+	// the arrays' instances and owner keeps the arrays alive.
+	void build(const CompiledArrays &arrays, const std::vector<std::shared_ptr<const CompiledScene>> &geometries,
+		const std::shared_ptr<const void> &owner)
+	{
+		gatherLights();
+		compiled.attach(arrays, geometries, owner);
+		animated.clear();
+		version++;
+	}
+
+	unsigned animatedCount() const { return (unsigned)animated.size(); }
+
+	// Move the animated instances to where they are at frame. Only the instances move, their
+	// geometry keeps its own BVH, so the scene's BVH above them is refitted to their new
+	// bounds, or rebuilt over the instances and other primitives once refits have made it
+	// rebuildCost times worse than a fresh one.
+	void animate(unsigned frame)
+	{
+		if (animated.empty()) return;
+		for (unsigned i = 0; i < animated.size(); ++i) {
+			animated[i].object->animate(frame);
+			compiled.moveInstance(animated[i].instance, animated[i].object->objectToWorld);
+		}
+		if (compiled.refit() > rebuildCost) {
+			compiled.build();
+			findAnimated();
+			rebuilds++;
+		}
+		else refits++;
+		version++;
+	}
+
+	bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &tnear, unsigned &primitive, unsigned &instance) const
+	{
+		return compiled.intersect(rayorig, raydir, tnear, primitive, instance);
+	}
+
+	bool occluded(const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const
+	{
+		return compiled.occluded(rayorig, raydir, tmax);
+	}
+
+	void intersectPacket(RayPacket &packet) const
+	{
+		compiled.intersectPacket(packet);
+	}
+
+	void occludedPacket(RayPacket &packet) const
+	{
+		compiled.occludedPacket(packet);
+	}
+
+	// Surface of a hit, instance is only used for hits on an instance
+	const Material &material(unsigned primitive, unsigned instance) const { return compiled.material(primitive, instance); }
+
+	// Surface normal of a hit at a point on its surface, not necessarily normalised.
+	// Triangles use their precomputed geometric normal.
+	Vec3f normal(unsigned primitive, unsigned instance, const Vec3f &phit) const
+	{
+		if (primitive & CompiledScene::kInstanceBit) return compiled.instanceNormal(primitive, instance);
+		if (primitive & CompiledScene::kTriangleBit) return compiled.triangleNormal(primitive & ~CompiledScene::kTriangleBit);
+		return phit - compiled.sphereCenter(primitive);
+	}
+
+private:
+	struct Animated
+	{
+		Instance* object;
+		unsigned instance;                  /// index in the compiled instances, which build() reorders
+	};
+
+	std::vector<Animated> animated;
+
+	void findAnimated()
+	{
+		std::map<const SceneObject*, Instance*> objectmap;
+		for (unsigned i = 0; i < objects.size(); ++i) {
+			Instance* instance = dynamic_cast<Instance*>(objects[i]);
+			if (instance && instance->animated()) objectmap[instance] = instance;
+		}
+		animated.clear();
+		for (unsigned i = 0; i < compiled.instanceCount() && !objectmap.empty(); ++i) {
+			std::map<const SceneObject*, Instance*>::const_iterator found = objectmap.find(compiled.source(i | CompiledScene::kInstanceBit));
+			if (found == objectmap.end()) continue;
+			Animated a = { found->second, i };
+			animated.push_back(a);
+		}
+	}
+
+	// Rays are traced against the compiled triangles, so a mesh only needs its own buffers
+	// when it is a light that shadow rays aim at
+	void releaseMeshes()
+	{
+		for (unsigned i = 0; i < objects.size(); ++i) {
+			TriangleMesh* mesh = dynamic_cast<TriangleMesh*>(objects[i]);
+			if (mesh && std::find(lights.begin(), lights.end(), mesh) == lights.end()) mesh->release();
+		}
+	}
+
+	void gatherLights()
+	{
+		lights.clear();
+		for (unsigned i = 0; i < objects.size(); ++i) {
+			if (objects[i]->emissionColor.x > 0) lights.push_back(objects[i]);
+		}
+	}
+
+	Scene(const Scene &);
+	Scene & operator=(const Scene &);
+};
@@ -0,0 +1,359 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Vec3.hpp"
+#include "Material.hpp"
+#include "BVH.hpp"
+#include "SceneObject.hpp"
+#include "Sphere.hpp"
+#include "Triangle.hpp"
+#include "TriangleMesh.hpp"
+#include "Instance.hpp"
+#include "CompiledScene.hpp"
+#include "Scene.hpp"
+#include "MappedFile.hpp"
+
+// Compiled scene cache. The file holds a header followed by every CompiledArrays array,
+// BVH nodes included, each starting on a 64 byte boundary, exactly as they sit in memory.
+// The geometry placed by instances follows, each written the same way and stored once
+// however many instances use it. Loading maps the file and points the scene straight at
+// it, so nothing is parsed, built or copied and pages are only read as rendering touches
+// them. Caches are tied to the layout of this build: the native byte order and the sizes in
+// the header must match. Every index the file holds is checked against the arrays it
+// points into before the scene uses it, so a damaged cache fails to load rather than
+// reading outside the mapping.
+struct SceneCacheArrays
+{
+	static const unsigned kArrays = 22;     /// every CompiledArrays array
+
+	uint32_t spheres, triangles, instances, materials, nodes, padding;
+	uint64_t offsets[kArrays];              /// from the start of the file
+};
+
+// A light as the scene had it: the compiled primitives of the object, several for a mesh,
+// and the point shadow rays aim at
+struct SceneCacheLight
+{
+	uint32_t first, count;                  /// range of the light's entries in the light primitives
+	float center[3];
+};
+
+struct SceneCacheHeader
+{
+	static const unsigned kVersion = 4;
+	static const unsigned kAlignment = 64;
+
+	char magic[8];                          /// "RTSCENE" and a terminating zero
+	uint32_t version;
+	uint32_t materialSize, nodeSize;        /// sizeof(Material) and sizeof(BVHNode) when written
+	uint32_t instanceSize;                  /// sizeof(InstanceTransform) when written
+	uint32_t lights, lightPrimitives, geometries;
+	uint32_t hasCamera;
+	float eye[3], tilt[3], fov;
+	uint64_t lightOffset;                   /// a SceneCacheLight for each light
+	uint64_t lightPrimitiveOffset;          /// compiled primitives of every light, in order
+	uint64_t geometryOffset;                /// a SceneCacheArrays for each geometry
+	SceneCacheArrays scene;
+
+	static const char* signature() { return "RTSCENE"; }
+};
+
+class SceneCache
+{
+public:
+	// True if path starts like a scene cache, so it should not be read as a text scene
+	static bool detect(const std::string &path)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		char magic[8] = {};
+		file.read(magic, sizeof(magic));
+		return file && memcmp(magic, SceneCacheHeader::signature(), sizeof(magic)) == 0;
+	}
+
+	// Write a scene, which must have been built, along with its lights and camera
+	static bool write(const std::string &path, const Scene &scene)
+	{
+		std::ofstream file(path.c_str(), std::ios::binary);
+		if (!file) return false;
+
+		const CompiledScene &compiled = scene.compiled;
+		const std::vector<std::shared_ptr<const CompiledScene>> &geometries = compiled.sharedGeometry();
+		std::vector<SceneCacheLight> lights;
+		std::vector<uint32_t> primitives;
+		lightPrimitives(scene, lights, primitives);
+
+		SceneCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SceneCacheHeader::signature(), sizeof(header.magic));
+		header.version = SceneCacheHeader::kVersion;
+		header.materialSize = sizeof(Material);
+		header.nodeSize = sizeof(BVHNode);
+		header.instanceSize = sizeof(InstanceTransform);
+		header.lights = (uint32_t)lights.size();
+		header.lightPrimitives = (uint32_t)primitives.size();
+		header.geometries = (uint32_t)geometries.size();
+		header.hasCamera = scene.hasCamera;
+		for (unsigned i = 0; i < 3; ++i) header.eye[i] = scene.camera.eye[i], header.tilt[i] = scene.camera.tilt[i];
+		header.fov = scene.camera.fov;
+		file.write((const char*)&header, sizeof(header));
+
+		header.scene = writeArrays(file, compiled);
+		header.lightOffset = writeAligned(file, lights.data(), header.lights);
+		header.lightPrimitiveOffset = writeAligned(file, primitives.data(), header.lightPrimitives);
+		std::vector<SceneCacheArrays> geometryarrays;
+		for (unsigned i = 0; i < geometries.size(); ++i)
+			geometryarrays.push_back(writeArrays(file, *geometries[i]));
+		header.geometryOffset = writeAligned(file, geometryarrays.data(), header.geometries);
+
+		file.seekp(0);
+		file.write((const char*)&header, sizeof(header));
+		return bool(file);
+	}
+
+	// Map a cache written by write() and make it the scene's compiled form, recreating
+	// the lights and camera. scene should be empty. Returns false if the file isn't a cache
+	// this build can use or its indices don't fit its arrays.
+	static bool load(const std::string &path, Scene &scene)
+	{
+		std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+		if (!file->open(path) || file->size() < sizeof(SceneCacheHeader)) return false;
+		const SceneCacheHeader &header = *(const SceneCacheHeader*)file->data();
+		if (memcmp(header.magic, SceneCacheHeader::signature(), sizeof(header.magic)) != 0 ||
+			header.version != SceneCacheHeader::kVersion ||
+			header.materialSize != sizeof(Material) || header.nodeSize != sizeof(BVHNode) ||
+			header.instanceSize != sizeof(InstanceTransform))
+			return false;
+
+		const SceneCacheLight* lights = NULL;
+		const uint32_t* lightprimitives = NULL;
+		const SceneCacheArrays* geometryarrays = NULL;
+		if (!mapArray(*file, header.lightOffset, header.lights, lights) ||
+			!mapArray(*file, header.lightPrimitiveOffset, header.lightPrimitives, lightprimitives) ||
+			!mapArray(*file, header.geometryOffset, header.geometries, geometryarrays))
+			return false;
+
+		// Geometry is mapped the same way, each sharing the file with the scene
+		std::vector<std::shared_ptr<const CompiledScene>> geometries;
+		for (unsigned i = 0; i < header.geometries; ++i) {
+			CompiledArrays arrays;
+			if (geometryarrays[i].instances || !mapArrays(file, geometryarrays[i], arrays) || !validArrays(arrays)) return false;
+			std::shared_ptr<CompiledScene> geometry = std::make_shared<CompiledScene>();
+			geometry->attach(arrays, std::vector<std::shared_ptr<const CompiledScene>>(), file);
+			geometries.push_back(geometry);
+		}
+
+		CompiledArrays arrays;
+		if (!mapArrays(file, header.scene, arrays) || !validArrays(arrays)) return false;
+		for (unsigned i = 0; i < arrays.instances; ++i) {
+			if (arrays.instanceGeometry[i] >= geometries.size() || geometries[arrays.instanceGeometry[i]]->nodeCount == 0) return false;
+		}
+		for (unsigned i = 0; i < header.lights; ++i) {
+			if (lights[i].count == 0 || (uint64_t)lights[i].first + lights[i].count > header.lightPrimitives) return false;
+			for (unsigned p = lights[i].first; p < lights[i].first + lights[i].count; ++p) {
+				uint32_t primitive = lightprimitives[p];
+				if ((primitive & ~CompiledScene::kKindBits) >= primitiveCount(arrays, primitive & CompiledScene::kKindBits)) return false;
+				// Only meshes compile to several primitives, all of them triangles
+				if (lights[i].count > 1 && (primitive & CompiledScene::kKindBits) != CompiledScene::kTriangleBit) return false;
+			}
+		}
+
+		for (unsigned i = 0; i < header.lights; ++i)
+			scene.add(lightObject(arrays, geometries, lights[i], lightprimitives + lights[i].first));
+		scene.hasCamera = header.hasCamera != 0;
+		scene.camera.eye = Vec3f(header.eye[0], header.eye[1], header.eye[2]);
+		scene.camera.tilt = Vec3f(header.tilt[0], header.tilt[1], header.tilt[2]);
+		scene.camera.fov = header.fov;
+		scene.build(arrays, geometries, file);
+		return true;
+	}
+
+private:
+	// Calls visit(array, count) on each array in file order, counts including padding
+	template<typename Visit>
+	static void forEachArray(CompiledArrays &arrays, Visit visit)
+	{
+		unsigned spheres = arrays.spheres + CompiledScene::kPadding;
+		unsigned triangles = arrays.triangles + CompiledScene::kPadding;
+		unsigned instances = arrays.instances + CompiledScene::kPadding;
+		visit(arrays.sphereX, spheres), visit(arrays.sphereY, spheres), visit(arrays.sphereZ, spheres);
+		visit(arrays.sphereRadius2, spheres);
+		visit(arrays.sphereMaterial, spheres);
+		visit(arrays.triangleAX, triangles), visit(arrays.triangleAY, triangles), visit(arrays.triangleAZ, triangles);
+		visit(arrays.triangleABX, triangles), visit(arrays.triangleABY, triangles), visit(arrays.triangleABZ, triangles);
+		visit(arrays.triangleACX, triangles), visit(arrays.triangleACY, triangles), visit(arrays.triangleACZ, triangles);
+		visit(arrays.triangleNX, triangles), visit(arrays.triangleNY, triangles), visit(arrays.triangleNZ, triangles);
+		visit(arrays.triangleMaterial, triangles);
+		visit(arrays.instanceTransforms, instances);
+		visit(arrays.instanceGeometry, instances);
+		visit(arrays.materials, arrays.materialCount);
+		visit(arrays.nodes, arrays.nodeCount);
+	}
+
+	static SceneCacheArrays writeArrays(std::ofstream &file, const CompiledArrays &compiled)
+	{
+		SceneCacheArrays written;
+		memset(&written, 0, sizeof(written));
+		written.spheres = compiled.spheres;
+		written.triangles = compiled.triangles;
+		written.instances = compiled.instances;
+		written.materials = compiled.materialCount;
+		written.nodes = compiled.nodeCount;
+		CompiledArrays arrays = compiled;
+		unsigned array = 0;
+		forEachArray(arrays, [&](auto &values, unsigned count) {
+			written.offsets[array++] = writeAligned(file, values, count);
+		});
+		return written;
+	}
+
+	// Point values at count elements of the file, false if they don't fit inside it
+	template<typename T>
+	static bool mapArray(const MappedFile &file, uint64_t offset, unsigned count, const T* &values)
+	{
+		bool inside = offset % SceneCacheHeader::kAlignment == 0 && offset + (uint64_t)count * sizeof(T) <= file.size();
+		values = inside ? (const T*)(file.data() + offset) : NULL;
+		return inside;
+	}
+
+	static bool mapArrays(const std::shared_ptr<MappedFile> &file, const SceneCacheArrays &written, CompiledArrays &arrays)
+	{
+		arrays.spheres = written.spheres;
+		arrays.triangles = written.triangles;
+		arrays.instances = written.instances;
+		arrays.materialCount = written.materials;
+		arrays.nodeCount = written.nodes;
+		unsigned array = 0;
+		bool inside = true;
+		forEachArray(arrays, [&](auto &values, unsigned count) {
+			inside = mapArray(*file, written.offsets[array++], count, values) && inside;
+		});
+		return inside;
+	}
+
+	// Number of primitives of one kind (CompiledScene::kKindBits) in arrays
+	static unsigned primitiveCount(const CompiledArrays &arrays, unsigned kind)
+	{
+		return kind == CompiledScene::kTriangleBit ? arrays.triangles : kind == CompiledScene::kInstanceBit ? arrays.instances :
+			kind == 0 ? arrays.spheres : 0;
+	}
+
+	// Whether the material indices and BVH of mapped arrays stay inside them: leaves cover
+	// primitives that exist, interior nodes point at children after themselves, so the tree
+	// has no cycles, and it is no deeper than the traversal stacks
+	static bool validArrays(const CompiledArrays &arrays)
+	{
+		for (unsigned i = 0; i < arrays.spheres; ++i) {
+			if (arrays.sphereMaterial[i] >= arrays.materialCount) return false;
+		}
+		for (unsigned i = 0; i < arrays.triangles; ++i) {
+			if (arrays.triangleMaterial[i] >= arrays.materialCount) return false;
+		}
+
+		std::vector<unsigned> depth(arrays.nodeCount, 0);
+		for (unsigned n = 0; n < arrays.nodeCount; ++n) {
+			const BVHNode &node = arrays.nodes[n];
+			if (depth[n] >= BVH::kMaxDepth) return false;
+			if (BVH::isLeaf(node)) {
+				if ((uint64_t)node.offset + BVH::leafCount(node) > primitiveCount(arrays, BVH::leafKind(node))) return false;
+				continue;
+			}
+			if (node.offset <= n + 1 || node.offset >= arrays.nodeCount) return false;
+			depth[n + 1] = std::max(depth[n + 1], depth[n] + 1);
+			depth[node.offset] = std::max(depth[node.offset], depth[n] + 1);
+		}
+		return true;
+	}
+
+	// Pad the file to the next aligned offset and write count values there
+	template<typename T>
+	static uint64_t writeAligned(std::ofstream &file, const T* values, unsigned count)
+	{
+		static const char zeros[SceneCacheHeader::kAlignment] = {};
+		uint64_t offset = (uint64_t)file.tellp();
+		uint64_t aligned = (offset + SceneCacheHeader::kAlignment - 1) / SceneCacheHeader::kAlignment * SceneCacheHeader::kAlignment;
+		file.write(zeros, (std::streamsize)(aligned - offset));
+		if (count) file.write((const char*)values, (std::streamsize)count * sizeof(T));
+		return aligned;
+	}
+
+	// Compiled primitives of each light, in the order of scene.lights. Every primitive an
+	// object compiled to is kept, so a mesh light comes back with all its triangles.
+	static void lightPrimitives(const Scene &scene, std::vector<SceneCacheLight> &lights, std::vector<uint32_t> &primitives)
+	{
+		const CompiledScene &compiled = scene.compiled;
+		std::map<const SceneObject*, unsigned> lightindex;
+		for (unsigned i = 0; i < scene.lights.size(); ++i) lightindex.insert(std::make_pair(scene.lights[i], i));
+		std::vector<std::vector<uint32_t>> perlight(scene.lights.size());
+		auto gather = [&](uint32_t primitive) {
+			std::map<const SceneObject*, unsigned>::const_iterator found = lightindex.find(compiled.source(primitive));
+			if (found != lightindex.end()) perlight[found->second].push_back(primitive);
+		};
+		for (unsigned i = 0; i < compiled.triangles; ++i) gather(i | CompiledScene::kTriangleBit);
+		for (unsigned i = 0; i < compiled.instances; ++i) gather(i | CompiledScene::kInstanceBit);
+		for (unsigned i = 0; i < compiled.spheres; ++i) gather(i);
+
+		for (unsigned i = 0; i < scene.lights.size(); ++i) {
+			if (perlight[i].empty()) continue;
+			const Vec3f &center = scene.lights[i]->center;
+			SceneCacheLight light = { (uint32_t)primitives.size(), (uint32_t)perlight[i].size(), { center.x, center.y, center.z } };
+			lights.push_back(light);
+			primitives.insert(primitives.end(), perlight[i].begin(), perlight[i].end());
+		}
+	}
+
+	// Shadow rays aim at scene objects, so each light is rebuilt from its primitives: a mesh
+	// from its triangles, anything else from its one primitive. The centre is the one the
+	// light had, which rebuilding from the compiled arrays could only round.
+	static SceneObject* lightObject(const CompiledArrays &arrays,
+		const std::vector<std::shared_ptr<const CompiledScene>> &geometries, const SceneCacheLight &light, const uint32_t* primitives)
+	{
+		SceneObject* object = lightPrimitive(arrays, geometries, light, primitives);
+		object->center = Vec3f(light.center[0], light.center[1], light.center[2]);
+		return object;
+	}
+
+	static SceneObject* lightPrimitive(const CompiledArrays &arrays,
+		const std::vector<std::shared_ptr<const CompiledScene>> &geometries, const SceneCacheLight &light, const uint32_t* primitives)
+	{
+		uint32_t primitive = primitives[0];
+		unsigned i = primitive & ~CompiledScene::kKindBits;
+		if (primitive & CompiledScene::kInstanceBit)
+			return new Instance(geometries[arrays.instanceGeometry[i]], arrays.instanceTransforms[i].objectToWorld);
+		bool triangle = (primitive & CompiledScene::kTriangleBit) != 0;
+		const Material &material = arrays.materials[triangle ? arrays.triangleMaterial[i] : arrays.sphereMaterial[i]];
+		if (light.count > 1) {
+			TriangleMesh* mesh = new TriangleMesh(material.surfaceColour, material.reflection, material.transparency, material.emissionColour);
+			for (unsigned p = 0; p < light.count; ++p) {
+				unsigned t = primitives[p] & ~CompiledScene::kKindBits;
+				Vec3f a(arrays.triangleAX[t], arrays.triangleAY[t], arrays.triangleAZ[t]);
+				Vec3f ab(arrays.triangleABX[t], arrays.triangleABY[t], arrays.triangleABZ[t]);
+				Vec3f ac(arrays.triangleACX[t], arrays.triangleACY[t], arrays.triangleACZ[t]);
+				unsigned first = (unsigned)mesh->vertices.size();
+				mesh->vertices.push_back(a), mesh->vertices.push_back(a + ab), mesh->vertices.push_back(a + ac);
+				mesh->indices.push_back(first), mesh->indices.push_back(first + 1), mesh->indices.push_back(first + 2);
+			}
+			mesh->update();
+			return mesh;
+		}
+		if (triangle) {
+			Vec3f a(arrays.triangleAX[i], arrays.triangleAY[i], arrays.triangleAZ[i]);
+			Vec3f ab(arrays.triangleABX[i], arrays.triangleABY[i], arrays.triangleABZ[i]);
+			Vec3f ac(arrays.triangleACX[i], arrays.triangleACY[i], arrays.triangleACZ[i]);
+			return new Triangle(a, a + ab, a + ac, material.surfaceColour, material.reflection,
+				material.transparency, material.emissionColour);
+		}
+		Vec3f center(arrays.sphereX[i], arrays.sphereY[i], arrays.sphereZ[i]);
+		Sphere* sphere = new Sphere(center, std::sqrt(arrays.sphereRadius2[i]), material.surfaceColour, material.reflection,
+			material.transparency, material.emissionColour);
+		sphere->radius2 = arrays.sphereRadius2[i];
+		return sphere;
+	}
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include "Vec3.hpp"
+#include "SceneObject.hpp"
+#include "Sphere.hpp"
+#include "Triangle.hpp"
+#include "Scene.hpp"
+#include "TriangleMesh.hpp"
+#include "Transform.hpp"
+#include "Instance.hpp"
+#include "ObjLoader.hpp"
+
+// Text scene description, one statement per line and # starting a comment:
+//
+//   camera <eye x y z> <tilt x y z> <fov>
+//   material <name> [surface r g b] [emission r g b] [reflection f] [transparency f]
+//   sphere <material> <center x y z> <radius>
+//   triangle <material> <a x y z> <b x y z> <c x y z>
+//   mesh <material> <path to .obj>
+//   object <name> <material> <path to .obj>
+//   instance <object> [translate x y z] [rotate <axis x y z> <degrees>] [scale x y z]
+//            [spin <axis x y z> <degrees per frame>]
+//   light <center x y z> <radius> <emission r g b>
+//
+// Materials must be defined before they are used and default to a white diffuse surface.
+// Any object with an emission is a light, the light statement is shorthand for a small
+// white sphere. Mesh paths are relative to the scene file. An object is a mesh that is
+// loaded and compiled once but not placed, each instance of it places a copy sharing its
+// geometry, with the transforms applied in the order given. A spin is a rotation that grows
+// every frame, so instances with one move. Without a camera statement the default orbit is
+// used.
+class SceneFile
+{
+public:
+	// Add the file's objects to scene, which is left for the caller to build. Returns
+	// false, after printing the line at fault, if the file can't be read or parsed.
+	static bool load(const std::string &path, Scene &scene)
+	{
+		std::ifstream file(path.c_str());
+		if (!file) {
+			std::cout << "Can't open " << path << std::endl;
+			return false;
+		}
+
+		SceneFile parser(path, scene);
+		std::string line;
+		for (parser.number = 1; std::getline(file, line); ++parser.number) {
+			std::string::size_type comment = line.find('#');
+			if (comment != std::string::npos) line.erase(comment);
+			std::istringstream statement(line);
+			std::string keyword;
+			if (!(statement >> keyword)) continue;
+			if (!parser.parse(keyword, statement)) return false;
+		}
+		return true;
+	}
+
+private:
+	struct SurfaceSettings
+	{
+		Vec3f surface = Vec3f(1);
+		Vec3f emission = Vec3f(0);
+		float reflection = 0;
+		float transparency = 0;
+	};
+
+	const std::string path;
+	Scene &scene;
+	unsigned number = 0;                    /// line being parsed
+	std::map<std::string, SurfaceSettings> materials;
+	std::map<std::string, std::shared_ptr<const CompiledScene>> objects;
+
+	SceneFile(const std::string &path, Scene &scene) : path(path), scene(scene) {}
+
+	bool parse(const std::string &keyword, std::istringstream &statement)
+	{
+		if (keyword == "camera") {
+			CameraPlacement camera;
+			if (!readVec3(statement, camera.eye) || !readVec3(statement, camera.tilt) || !(statement >> camera.fov))
+				return error("expected camera <eye x y z> <tilt x y z> <fov>");
+			scene.camera = camera;
+			scene.hasCamera = true;
+		}
+		else if (keyword == "material") {
+			std::string name, setting;
+			if (!(statement >> name)) return error("expected a material name");
+			SurfaceSettings material;
+			while (statement >> setting) {
+				bool valid;
+				if (setting == "surface") valid = readVec3(statement, material.surface);
+				else if (setting == "emission") valid = readVec3(statement, material.emission);
+				else if (setting == "reflection") valid = bool(statement >> material.reflection);
+				else if (setting == "transparency") valid = bool(statement >> material.transparency);
+				else return error("unknown material setting " + setting);
+				if (!valid) return error("expected values after " + setting);
+			}
+			materials[name] = material;
+		}
+		else if (keyword == "sphere") {
+			const SurfaceSettings* material;
+			Vec3f center;
+			float radius;
+			if (!readMaterial(statement, material)) return false;
+			if (!readVec3(statement, center) || !(statement >> radius)) return error("expected sphere <material> <center x y z> <radius>");
+			scene.add(new Sphere(center, radius, material->surface, material->reflection, material->transparency, material->emission));
+		}
+		else if (keyword == "triangle") {
+			const SurfaceSettings* material;
+			Vec3f a, b, c;
+			if (!readMaterial(statement, material)) return false;
+			if (!readVec3(statement, a) || !readVec3(statement, b) || !readVec3(statement, c))
+				return error("expected triangle <material> <a x y z> <b x y z> <c x y z>");
+			scene.add(new Triangle(a, b, c, material->surface, material->reflection, material->transparency, material->emission));
+		}
+		else if (keyword == "mesh") {
+			const SurfaceSettings* material;
+			std::string objpath;
+			if (!readMaterial(statement, material)) return false;
+			if (!(statement >> objpath)) return error("expected mesh <material> <path>");
+			std::unique_ptr<TriangleMesh> mesh(new TriangleMesh(material->surface, material->reflection, material->transparency, material->emission));
+			if (!ObjLoader::load(relativePath(objpath), mesh->vertices, mesh->indices)) return false; // the loader says why
+			mesh->update();
+			scene.add(mesh.release());
+		}
+		else if (keyword == "object") {
+			const SurfaceSettings* material;
+			std::string name, objpath;
+			if (!(statement >> name)) return error("expected an object name");
+			if (!readMaterial(statement, material)) return false;
+			if (!(statement >> objpath)) return error("expected object <name> <material> <path>");
+			TriangleMesh mesh(material->surface, material->reflection, material->transparency, material->emission);
+			if (!ObjLoader::load(relativePath(objpath), mesh.vertices, mesh.indices)) return false;
+			objects[name] = Instance::compile(mesh);
+		}
+		else if (keyword == "instance") {
+			std::string name, step;
+			if (!(statement >> name)) return error("expected an object name");
+			std::map<std::string, std::shared_ptr<const CompiledScene>>::const_iterator found = objects.find(name);
+			if (found == objects.end()) return error("undefined object " + name);
+			std::unique_ptr<Instance> instance(new Instance(found->second, Transform()));
+			while (statement >> step) {
+				Vec3f v;
+				float degrees;
+				if (step == "translate" && readVec3(statement, v)) instance->place(Transform::translate(v));
+				else if (step == "rotate" && readVec3(statement, v) && statement >> degrees) instance->place(Transform::rotate(v, degrees));
+				else if (step == "scale" && readVec3(statement, v)) instance->place(Transform::scale(v));
+				else if (step == "spin" && readVec3(statement, v) && statement >> degrees) instance->spin(v, degrees);
+				else if (step == "translate" || step == "rotate" || step == "scale" || step == "spin") return error("expected values after " + step);
+				else return error("unknown transform " + step);
+			}
+			scene.add(instance.release());
+		}
+		else if (keyword == "light") {
+			Vec3f center, emission;
+			float radius;
+			if (!readVec3(statement, center) || !(statement >> radius) || !readVec3(statement, emission))
+				return error("expected light <center x y z> <radius> <emission r g b>");
+			scene.add(new Sphere(center, radius, Vec3f(1), 0, 0, emission));
+		}
+		else return error("unknown statement " + keyword);
+
+		std::string extra;
+		if (statement >> extra) return error("unexpected " + extra);
+		return true;
+	}
+
+	bool readMaterial(std::istringstream &statement, const SurfaceSettings* &material)
+	{
+		std::string name;
+		if (!(statement >> name)) return error("expected a material name");
+		std::map<std::string, SurfaceSettings>::const_iterator found = materials.find(name);
+		if (found == materials.end()) return error("undefined material " + name);
+		material = &found->second;
+		return true;
+	}
+
+	static bool readVec3(std::istringstream &statement, Vec3f &v)
+	{
+		return bool(statement >> v.x >> v.y >> v.z);
+	}
+
+	std::string relativePath(const std::string &file) const
+	{
+		if (!file.empty() && (file[0] == '/' || file[0] == '\\' || file.find(':') != std::string::npos)) return file;
+		std::string::size_type slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? file : path.substr(0, slash + 1) + file;
+	}
+
+	bool error(const std::string &message) const
+	{
+		std::cout << path << ":" << number << ": " << message << std::endl;
+		return false;
+	}
+};
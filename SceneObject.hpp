@@ -1,6 +1,9 @@
 #pragma once
 #include "Vec3.hpp"
 #include "Material.hpp"
+#include "AABB.hpp"
+
+class CompiledScene;
 
 class SceneObject
 {
@@ -9,6 +12,13 @@ public:
 	Vec3f surfaceColor, emissionColor;      /// surface color and emission (light) 
 	float transparency, reflection;         /// surface transparency and reflectivity 
 	Material material;
+	virtual ~SceneObject() {}
 	virtual bool intersect(const Vec3f &rayorig, const Vec3f &raydir,
 		float &t, float &u, float &v) const = 0;
+	// Any-hit test for shadow rays, true if the ray hits the object before tmax
+	virtual bool occluded(const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const = 0;
+	virtual AABB bounds() const = 0;
+
+	// Add the object's primitives and material to the compiled form of the scene
+	virtual void compile(CompiledScene &compiled) const = 0;
 };
\ No newline at end of file
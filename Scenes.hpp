@@ -0,0 +1,132 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "Vec3.hpp"
+#include "Material.hpp"
+#include "SceneObject.hpp"
+#include "Sphere.hpp"
+#include "Triangle.hpp"
+#include "TriangleMesh.hpp"
+#include "Transform.hpp"
+#include "Instance.hpp"
+#include "Scene.hpp"
+
+#if !defined(M_PI)
+#define M_PI 3.141592653589793
+#endif
+
+// Built in scenes. All of them sit in the same box, so the default camera orbit frames
+// each one. Scene::build() is left to the caller.
+
+// Walls of the box, made of huge spheres
+inline void addCornellBox(Scene &scene)
+{
+	scene.add(new Sphere(Vec3f(-1e5 - 100, 40.8, 81.6), 1e5, Vec3f(0.75, 0.25, 0.25), 0, 0.0, Vec3f(0))); // Left
+	scene.add(new Sphere(Vec3f(1e5 + 100, 40.8, 81.6), 1e5, Vec3f(0.25, 0.25, 0.75), 0, 0.0, Vec3f(0))); // Right
+	scene.add(new Sphere(Vec3f(0, 40.8, -1e5 - 81.6), 1e5, Vec3f(0.25, 0.25, 0.25), 1.0, 0.0, Vec3f(0.0))); // Back
+	scene.add(new Sphere(Vec3f(0, 40.8, 1e5 + 81.6), 1e5, Vec3f(0.75, 0.75, 0.75), 0, 0.0, Vec3f(0.0))); // Front
+	scene.add(new Sphere(Vec3f(0, 1e5 + 120.6, 81.6), 1e5, Vec3f(0.75, 0.25, 0.75), 0, 0.0, Vec3f(0.0, 0.0, 0.0))); // Top
+	scene.add(new Sphere(Vec3f(0, -1e5 - 60.8, 81.6), 1e5, Vec3f(0.75, 0.75, 0.25), 0, 0.0, Vec3f(0, 0, 0))); // Bottom
+}
+
+// Small spherical light above the middle of the box
+inline void addCornellLight(Scene &scene)
+{
+	scene.add(new Sphere(Vec3f(0, 80.6, 50), 1, Vec3f(1.0, 1.0, 1.0), 1.0, 0, Vec3f(1, 1, 1))); // Light
+}
+
+// The box with a mirror sphere, a glass sphere and an emissive triangle
+inline void buildCornellScene(Scene &scene)
+{
+	addCornellBox(scene);
+
+	// Spheres in box
+	scene.add(new Sphere(Vec3f(-50, 16.5, 77), 1, Vec3f(1.0, 1.0, 1.0), 1.0, 0.0, Vec3f(0.0), Material())); // Mirror
+	scene.add(new Sphere(Vec3f(50, 16.5, 78), 4.5, Vec3f(1.0, 1.0, 1.0), 0, 1, Vec3f(0.0), Material())); // Glass
+
+	addCornellLight(scene);
+
+	// Triangle
+	scene.add(new Triangle(Vec3f(90, 30, 10), Vec3f(10, 50, -30), Vec3f(10, -30, 70), Vec3f(0.2, 1.0, 0.2), 0, 0, Vec3f(1.0, 1.0, 1.0)));
+}
+
+// Diffuse torus mesh of 2 * segments * segments / 2 triangles lying flat around centre
+inline TriangleMesh* makeTorus(const Vec3f &centre, float major, float minor, unsigned segments, const Vec3f &colour)
+{
+	TriangleMesh* torus = new TriangleMesh(colour, 0, 0);
+	unsigned rings = segments, sides = segments / 2;
+	for (unsigned i = 0; i < rings; ++i) {
+		for (unsigned j = 0; j < sides; ++j) {
+			float u = 2 * float(M_PI) * i / rings, v = 2 * float(M_PI) * j / sides;
+			torus->vertices.push_back(centre + Vec3f((major + minor * cos(v)) * cos(u), minor * sin(v), (major + minor * cos(v)) * sin(u)));
+		}
+	}
+	auto vertex = [&](unsigned i, unsigned j) { return (i % rings) * sides + j % sides; };
+	// Triangles are only hit from the front, so wind each one to face away from the tube
+	auto addFacing = [&](unsigned a, unsigned b, unsigned c, const Vec3f &ring) {
+		const std::vector<Vec3f> &v = torus->vertices;
+		Vec3f outward = (v[a] + v[b] + v[c]) * (1.0f / 3) - ring;
+		if ((v[b] - v[a]).crossProduct(v[c] - v[a]).dot(outward) <= 0) std::swap(b, c);
+		torus->indices.push_back(a), torus->indices.push_back(b), torus->indices.push_back(c);
+	};
+	for (unsigned i = 0; i < rings; ++i) {
+		float u = 2 * float(M_PI) * (i + 0.5f) / rings;
+		Vec3f ring = centre + Vec3f(major * cos(u), 0, major * sin(u));
+		for (unsigned j = 0; j < sides; ++j) {
+			addFacing(vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1), ring);
+			addFacing(vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1), ring);
+		}
+	}
+	torus->update();
+	return torus;
+}
+
+// The box with a diffuse torus mesh of 2 * segments * segments / 2 triangles
+inline void buildMeshScene(Scene &scene, unsigned segments)
+{
+	addCornellBox(scene);
+	addCornellLight(scene);
+	scene.add(makeTorus(Vec3f(0, 10, 40), 35, 14, segments, Vec3f(0.9, 0.6, 0.3)));
+}
+
+// The box with rings of count small tori each, all instances of one geometry. Every torus
+// tumbles in place while the rings orbit the middle of the box, neighbouring rings in
+// opposite directions, so the scene's BVH is refitted every frame and rebuilt as it drifts.
+inline void buildInstanceScene(Scene &scene, unsigned count)
+{
+	addCornellBox(scene);
+	addCornellLight(scene);
+
+	std::unique_ptr<TriangleMesh> torus(makeTorus(Vec3f(0), 5, 2, 32, Vec3f(0.3, 0.6, 0.9)));
+	std::shared_ptr<const CompiledScene> geometry = Instance::compile(*torus);
+	for (unsigned ring = 0; ring < count; ++ring) {
+		float radius = 15 + 60.0f * ring / count, speed = (ring % 2 ? -1 : 1) * (0.5f + 2.0f * ring / count);
+		for (unsigned i = 0; i < count; ++i) {
+			Instance* instance = new Instance(geometry, Transform());
+			instance->spin(Vec3f(1, float(i % 3), float(ring % 2)), 4);
+			instance->place(Transform::translate(Vec3f(radius, -45 + 10.0f * (i % 3), 0)));
+			instance->place(Transform::rotate(Vec3f(0, 1, 0), 360.0f * i / count));
+			instance->spin(Vec3f(0, 1, 0), speed);
+			scene.add(instance);
+		}
+	}
+}
+
+// The box with a floor of count x count small spheres, every fifth one a mirror
+inline void buildSphereFieldScene(Scene &scene, unsigned count)
+{
+	addCornellBox(scene);
+	addCornellLight(scene);
+
+	float spacing = 180.0f / count, radius = spacing * 0.4f;
+	for (unsigned i = 0; i < count; ++i) {
+		for (unsigned j = 0; j < count; ++j) {
+			Vec3f centre(-90 + spacing * (i + 0.5f), -60.8f + radius, -70 + spacing * (j + 0.5f));
+			Vec3f colour(0.3f + 0.7f * i / count, 0.3f + 0.7f * j / count, 0.5f);
+			bool mirror = (i * count + j) % 5 == 0;
+			scene.add(new Sphere(centre, radius, colour, mirror ? 1.0f : 0.0f, 0.0f));
+		}
+	}
+}
@@ -0,0 +1,315 @@
+// Intersection and display kernels. This file is included by SIMD.hpp once per instruction set, inside a
+// namespace that defines vfloat, vmask, kWidth, RT_KERNEL and the v* operations, so the
+// same source is compiled for scalar, SSE and AVX2. The packet kernels walk a packet kWidth
+// lanes at a time and skip groups with no active rays, the range kernels test one ray
+// against kWidth consecutive primitives at a time.
+
+static const unsigned kGroupMask = (1u << kWidth) - 1;
+
+// Slab test of every ray in lanes against a box. Returns the lanes that hit the box closer
+// than their current tnear, and the smallest entry distance among them in tentry.
+RT_KERNEL unsigned intersectBoxPacket(const RayPacket &packet, unsigned lanes, const AABB &box, float &tentry)
+{
+	vfloat minx = vset1(box.bmin.x), miny = vset1(box.bmin.y), minz = vset1(box.bmin.z);
+	vfloat maxx = vset1(box.bmax.x), maxy = vset1(box.bmax.y), maxz = vset1(box.bmax.z);
+	vfloat zero = vset1(0);
+	alignas(32) float entry[RayPacket::kSize];
+	unsigned hits = 0;
+	for (unsigned base = 0; base < RayPacket::kSize; base += kWidth) {
+		unsigned group = (lanes >> base) & kGroupMask;
+		if (!group) continue;
+		vfloat ox = vload(packet.ox + base), oy = vload(packet.oy + base), oz = vload(packet.oz + base);
+		vfloat idx = vload(packet.idx + base), idy = vload(packet.idy + base), idz = vload(packet.idz + base);
+		vfloat tx0 = vmul(vsub(minx, ox), idx), tx1 = vmul(vsub(maxx, ox), idx);
+		vfloat ty0 = vmul(vsub(miny, oy), idy), ty1 = vmul(vsub(maxy, oy), idy);
+		vfloat tz0 = vmul(vsub(minz, oz), idz), tz1 = vmul(vsub(maxz, oz), idz);
+		vfloat tnear = vmax(vmax(vmin(tx0, tx1), vmin(ty0, ty1)), vmin(tz0, tz1));
+		vfloat tfar = vmin(vmin(vmax(tx0, tx1), vmax(ty0, ty1)), vmax(tz0, tz1));
+		vmask hit = vand(vand(vcmple(tnear, tfar), vcmpge(tfar, zero)), vcmplt(tnear, vload(packet.tnear + base)));
+		hits |= (vmovemask(hit) & group) << base;
+		vstore(entry + base, tnear);
+	}
+	tentry = std::numeric_limits<float>::infinity();
+	for (unsigned i = 0; i < RayPacket::kSize; ++i) {
+		if (hits & (1u << i)) tentry = std::min(tentry, entry[i]);
+	}
+	return hits;
+}
+
+// Geometric ray-sphere test matching Sphere::intersect, keeping the closest hit per ray
+RT_KERNEL void intersectSpherePacket(RayPacket &packet, const Vec3f &center, float radius2, unsigned primitive)
+{
+	vfloat cx = vset1(center.x), cy = vset1(center.y), cz = vset1(center.z);
+	vfloat r2 = vset1(radius2), zero = vset1(0);
+	for (unsigned base = 0; base < RayPacket::kSize; base += kWidth) {
+		unsigned group = (packet.active >> base) & kGroupMask;
+		if (!group) continue;
+		vfloat lx = vsub(cx, vload(packet.ox + base)), ly = vsub(cy, vload(packet.oy + base)), lz = vsub(cz, vload(packet.oz + base));
+		vfloat tca = vadd(vadd(vmul(lx, vload(packet.dx + base)), vmul(ly, vload(packet.dy + base))), vmul(lz, vload(packet.dz + base)));
+		vfloat d2 = vsub(vadd(vadd(vmul(lx, lx), vmul(ly, ly)), vmul(lz, lz)), vmul(tca, tca));
+		vmask valid = vand(vcmpge(tca, zero), vcmple(d2, r2));
+		vfloat thc = vsqrt(vmax(vsub(r2, d2), zero));
+		vfloat t0 = vsub(tca, thc), t1 = vadd(tca, thc);
+		vfloat t = vselect(vcmplt(t0, zero), t1, t0);
+		vfloat tnear = vload(packet.tnear + base);
+		valid = vand(valid, vcmplt(t, tnear));
+		unsigned hits = vmovemask(valid) & group;
+		if (!hits) continue;
+		vstore(packet.tnear + base, vselect(valid, t, tnear));
+		for (unsigned i = 0; i < kWidth; ++i) {
+			if (hits & (1u << i)) packet.hit[base + i] = primitive;
+		}
+	}
+}
+
+// Any-hit sphere test for shadow packets, tnear holds each ray's maximum distance
+RT_KERNEL void occludedSpherePacket(RayPacket &packet, const Vec3f &center, float radius2)
+{
+	vfloat cx = vset1(center.x), cy = vset1(center.y), cz = vset1(center.z);
+	vfloat r2 = vset1(radius2), zero = vset1(0);
+	unsigned lanes = packet.active & ~packet.occluded;
+	for (unsigned base = 0; base < RayPacket::kSize; base += kWidth) {
+		unsigned group = (lanes >> base) & kGroupMask;
+		if (!group) continue;
+		vfloat lx = vsub(cx, vload(packet.ox + base)), ly = vsub(cy, vload(packet.oy + base)), lz = vsub(cz, vload(packet.oz + base));
+		vfloat tca = vadd(vadd(vmul(lx, vload(packet.dx + base)), vmul(ly, vload(packet.dy + base))), vmul(lz, vload(packet.dz + base)));
+		vfloat d2 = vsub(vadd(vadd(vmul(lx, lx), vmul(ly, ly)), vmul(lz, lz)), vmul(tca, tca));
+		vmask valid = vand(vcmpge(tca, zero), vcmple(d2, r2));
+		vfloat thc = vsqrt(vmax(vsub(r2, d2), zero));
+		vfloat t0 = vsub(tca, thc), t1 = vadd(tca, thc);
+		vfloat t = vselect(vcmplt(t0, zero), t1, t0);
+		valid = vand(valid, vcmplt(t, vload(packet.tnear + base)));
+		packet.occluded |= (vmovemask(valid) & group) << base;
+	}
+}
+
+// Moller-Trumbore test matching Triangle::intersect, with the edges ab and ac precomputed
+RT_KERNEL void intersectTrianglePacket(RayPacket &packet, const Vec3f &a, const Vec3f &ab, const Vec3f &ac, unsigned primitive)
+{
+	vfloat ax = vset1(a.x), ay = vset1(a.y), az = vset1(a.z);
+	vfloat abx = vset1(ab.x), aby = vset1(ab.y), abz = vset1(ab.z);
+	vfloat acx = vset1(ac.x), acy = vset1(ac.y), acz = vset1(ac.z);
+	vfloat zero = vset1(0), one = vset1(1), epsilon = vset1(kEpsilon);
+	for (unsigned base = 0; base < RayPacket::kSize; base += kWidth) {
+		unsigned group = (packet.active >> base) & kGroupMask;
+		if (!group) continue;
+		vfloat dx = vload(packet.dx + base), dy = vload(packet.dy + base), dz = vload(packet.dz + base);
+		vfloat px = vsub(vmul(dy, acz), vmul(dz, acy));
+		vfloat py = vsub(vmul(dz, acx), vmul(dx, acz));
+		vfloat pz = vsub(vmul(dx, acy), vmul(dy, acx));
+		vfloat det = vadd(vadd(vmul(abx, px), vmul(aby, py)), vmul(abz, pz));
+		vmask valid = vcmpge(det, epsilon);
+		if (!(vmovemask(valid) & group)) continue;
+		vfloat invdet = vdiv(one, det);
+		vfloat tx = vsub(vload(packet.ox + base), ax), ty = vsub(vload(packet.oy + base), ay), tz = vsub(vload(packet.oz + base), az);
+		vfloat u = vmul(vadd(vadd(vmul(tx, px), vmul(ty, py)), vmul(tz, pz)), invdet);
+		valid = vand(valid, vand(vcmpge(u, zero), vcmple(u, one)));
+		vfloat qx = vsub(vmul(ty, abz), vmul(tz, aby));
+		vfloat qy = vsub(vmul(tz, abx), vmul(tx, abz));
+		vfloat qz = vsub(vmul(tx, aby), vmul(ty, abx));
+		vfloat v = vmul(vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz)), invdet);
+		valid = vand(valid, vand(vcmpge(v, zero), vcmple(vadd(u, v), one)));
+		vfloat t = vmul(vadd(vadd(vmul(acx, qx), vmul(acy, qy)), vmul(acz, qz)), invdet);
+		vfloat tnear = vload(packet.tnear + base);
+		valid = vand(valid, vand(vcmpge(t, zero), vcmplt(t, tnear)));
+		unsigned hits = vmovemask(valid) & group;
+		if (!hits) continue;
+		vstore(packet.tnear + base, vselect(valid, t, tnear));
+		for (unsigned i = 0; i < kWidth; ++i) {
+			if (hits & (1u << i)) packet.hit[base + i] = primitive;
+		}
+	}
+}
+
+// Any-hit triangle test for shadow packets, tnear holds each ray's maximum distance
+RT_KERNEL void occludedTrianglePacket(RayPacket &packet, const Vec3f &a, const Vec3f &ab, const Vec3f &ac)
+{
+	vfloat ax = vset1(a.x), ay = vset1(a.y), az = vset1(a.z);
+	vfloat abx = vset1(ab.x), aby = vset1(ab.y), abz = vset1(ab.z);
+	vfloat acx = vset1(ac.x), acy = vset1(ac.y), acz = vset1(ac.z);
+	vfloat zero = vset1(0), epsilon = vset1(kEpsilon);
+	unsigned lanes = packet.active & ~packet.occluded;
+	for (unsigned base = 0; base < RayPacket::kSize; base += kWidth) {
+		unsigned group = (lanes >> base) & kGroupMask;
+		if (!group) continue;
+		vfloat dx = vload(packet.dx + base), dy = vload(packet.dy + base), dz = vload(packet.dz + base);
+		vfloat px = vsub(vmul(dy, acz), vmul(dz, acy));
+		vfloat py = vsub(vmul(dz, acx), vmul(dx, acz));
+		vfloat pz = vsub(vmul(dx, acy), vmul(dy, acx));
+		vfloat det = vadd(vadd(vmul(abx, px), vmul(aby, py)), vmul(abz, pz));
+		vmask valid = vcmpge(det, epsilon);
+		if (!(vmovemask(valid) & group)) continue;
+		// compare against the scaled determinant, as Triangle::occluded does
+		vfloat tx = vsub(vload(packet.ox + base), ax), ty = vsub(vload(packet.oy + base), ay), tz = vsub(vload(packet.oz + base), az);
+		vfloat u = vadd(vadd(vmul(tx, px), vmul(ty, py)), vmul(tz, pz));
+		valid = vand(valid, vand(vcmpge(u, zero), vcmple(u, det)));
+		vfloat qx = vsub(vmul(ty, abz), vmul(tz, aby));
+		vfloat qy = vsub(vmul(tz, abx), vmul(tx, abz));
+		vfloat qz = vsub(vmul(tx, aby), vmul(ty, abx));
+		vfloat v = vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz));
+		valid = vand(valid, vand(vcmpge(v, zero), vcmple(vadd(u, v), det)));
+		vfloat t = vadd(vadd(vmul(acx, qx), vmul(acy, qy)), vmul(acz, qz));
+		valid = vand(valid, vand(vcmpge(t, zero), vcmplt(t, vmul(vload(packet.tnear + base), det))));
+		packet.occluded |= (vmovemask(valid) & group) << base;
+	}
+}
+
+// Lanes of a range kernel holding one of the remaining primitives
+inline unsigned rangeMask(unsigned remaining)
+{
+	return remaining >= kWidth ? kGroupMask : (1u << remaining) - 1;
+}
+
+// One ray against count spheres starting at first, keeping the closest hit
+RT_KERNEL void intersectSpheres(const SphereArrays &spheres, unsigned first, unsigned count,
+	const Vec3f &rayorig, const Vec3f &raydir, float &tnear, unsigned &primitive)
+{
+	vfloat ox = vset1(rayorig.x), oy = vset1(rayorig.y), oz = vset1(rayorig.z);
+	vfloat dx = vset1(raydir.x), dy = vset1(raydir.y), dz = vset1(raydir.z);
+	vfloat zero = vset1(0);
+	alignas(32) float t[kWidth];
+	for (unsigned i = 0; i < count; i += kWidth) {
+		unsigned base = first + i;
+		vfloat lx = vsub(vloadu(spheres.x + base), ox), ly = vsub(vloadu(spheres.y + base), oy), lz = vsub(vloadu(spheres.z + base), oz);
+		vfloat r2 = vloadu(spheres.radius2 + base);
+		vfloat tca = vadd(vadd(vmul(lx, dx), vmul(ly, dy)), vmul(lz, dz));
+		vfloat d2 = vsub(vadd(vadd(vmul(lx, lx), vmul(ly, ly)), vmul(lz, lz)), vmul(tca, tca));
+		vmask valid = vand(vcmpge(tca, zero), vcmple(d2, r2));
+		vfloat thc = vsqrt(vmax(vsub(r2, d2), zero));
+		vfloat t0 = vsub(tca, thc), t1 = vadd(tca, thc);
+		vfloat thit = vselect(vcmplt(t0, zero), t1, t0);
+		valid = vand(valid, vcmplt(thit, vset1(tnear)));
+		unsigned hits = vmovemask(valid) & rangeMask(count - i);
+		if (!hits) continue;
+		vstore(t, thit);
+		for (unsigned j = 0; j < kWidth; ++j) {
+			if ((hits & (1u << j)) && t[j] < tnear) tnear = t[j], primitive = base + j;
+		}
+	}
+}
+
+// One ray against count spheres starting at first, true if any is hit before tmax
+RT_KERNEL bool occludedSpheres(const SphereArrays &spheres, unsigned first, unsigned count,
+	const Vec3f &rayorig, const Vec3f &raydir, float tmax)
+{
+	vfloat ox = vset1(rayorig.x), oy = vset1(rayorig.y), oz = vset1(rayorig.z);
+	vfloat dx = vset1(raydir.x), dy = vset1(raydir.y), dz = vset1(raydir.z);
+	vfloat zero = vset1(0), limit = vset1(tmax);
+	for (unsigned i = 0; i < count; i += kWidth) {
+		unsigned base = first + i;
+		vfloat lx = vsub(vloadu(spheres.x + base), ox), ly = vsub(vloadu(spheres.y + base), oy), lz = vsub(vloadu(spheres.z + base), oz);
+		vfloat r2 = vloadu(spheres.radius2 + base);
+		vfloat tca = vadd(vadd(vmul(lx, dx), vmul(ly, dy)), vmul(lz, dz));
+		vfloat d2 = vsub(vadd(vadd(vmul(lx, lx), vmul(ly, ly)), vmul(lz, lz)), vmul(tca, tca));
+		vmask valid = vand(vcmpge(tca, zero), vcmple(d2, r2));
+		vfloat thc = vsqrt(vmax(vsub(r2, d2), zero));
+		vfloat t0 = vsub(tca, thc), t1 = vadd(tca, thc);
+		valid = vand(valid, vcmplt(vselect(vcmplt(t0, zero), t1, t0), limit));
+		if (vmovemask(valid) & rangeMask(count - i)) return true;
+	}
+	return false;
+}
+
+// One ray against count triangles starting at first, keeping the closest hit
+RT_KERNEL void intersectTriangles(const TriangleArrays &triangles, unsigned first, unsigned count,
+	const Vec3f &rayorig, const Vec3f &raydir, float &tnear, unsigned &primitive)
+{
+	vfloat ox = vset1(rayorig.x), oy = vset1(rayorig.y), oz = vset1(rayorig.z);
+	vfloat dx = vset1(raydir.x), dy = vset1(raydir.y), dz = vset1(raydir.z);
+	vfloat zero = vset1(0), one = vset1(1), epsilon = vset1(kEpsilon);
+	alignas(32) float t[kWidth];
+	for (unsigned i = 0; i < count; i += kWidth) {
+		unsigned base = first + i;
+		unsigned group = rangeMask(count - i);
+		vfloat abx = vloadu(triangles.abx + base), aby = vloadu(triangles.aby + base), abz = vloadu(triangles.abz + base);
+		vfloat acx = vloadu(triangles.acx + base), acy = vloadu(triangles.acy + base), acz = vloadu(triangles.acz + base);
+		vfloat px = vsub(vmul(dy, acz), vmul(dz, acy));
+		vfloat py = vsub(vmul(dz, acx), vmul(dx, acz));
+		vfloat pz = vsub(vmul(dx, acy), vmul(dy, acx));
+		vfloat det = vadd(vadd(vmul(abx, px), vmul(aby, py)), vmul(abz, pz));
+		vmask valid = vcmpge(det, epsilon);
+		if (!(vmovemask(valid) & group)) continue;
+		vfloat invdet = vdiv(one, det);
+		vfloat tx = vsub(ox, vloadu(triangles.ax + base)), ty = vsub(oy, vloadu(triangles.ay + base)), tz = vsub(oz, vloadu(triangles.az + base));
+		vfloat u = vmul(vadd(vadd(vmul(tx, px), vmul(ty, py)), vmul(tz, pz)), invdet);
+		valid = vand(valid, vand(vcmpge(u, zero), vcmple(u, one)));
+		vfloat qx = vsub(vmul(ty, abz), vmul(tz, aby));
+		vfloat qy = vsub(vmul(tz, abx), vmul(tx, abz));
+		vfloat qz = vsub(vmul(tx, aby), vmul(ty, abx));
+		vfloat v = vmul(vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz)), invdet);
+		valid = vand(valid, vand(vcmpge(v, zero), vcmple(vadd(u, v), one)));
+		vfloat thit = vmul(vadd(vadd(vmul(acx, qx), vmul(acy, qy)), vmul(acz, qz)), invdet);
+		valid = vand(valid, vand(vcmpge(thit, zero), vcmplt(thit, vset1(tnear))));
+		unsigned hits = vmovemask(valid) & group;
+		if (!hits) continue;
+		vstore(t, thit);
+		for (unsigned j = 0; j < kWidth; ++j) {
+			if ((hits & (1u << j)) && t[j] < tnear) tnear = t[j], primitive = base + j;
+		}
+	}
+}
+
+// One ray against count triangles starting at first, true if any is hit before tmax
+RT_KERNEL bool occludedTriangles(const TriangleArrays &triangles, unsigned first, unsigned count,
+	const Vec3f &rayorig, const Vec3f &raydir, float tmax)
+{
+	vfloat ox = vset1(rayorig.x), oy = vset1(rayorig.y), oz = vset1(rayorig.z);
+	vfloat dx = vset1(raydir.x), dy = vset1(raydir.y), dz = vset1(raydir.z);
+	vfloat zero = vset1(0), epsilon = vset1(kEpsilon), limit = vset1(tmax);
+	for (unsigned i = 0; i < count; i += kWidth) {
+		unsigned base = first + i;
+		unsigned group = rangeMask(count - i);
+		vfloat abx = vloadu(triangles.abx + base), aby = vloadu(triangles.aby + base), abz = vloadu(triangles.abz + base);
+		vfloat acx = vloadu(triangles.acx + base), acy = vloadu(triangles.acy + base), acz = vloadu(triangles.acz + base);
+		vfloat px = vsub(vmul(dy, acz), vmul(dz, acy));
+		vfloat py = vsub(vmul(dz, acx), vmul(dx, acz));
+		vfloat pz = vsub(vmul(dx, acy), vmul(dy, acx));
+		vfloat det = vadd(vadd(vmul(abx, px), vmul(aby, py)), vmul(abz, pz));
+		vmask valid = vcmpge(det, epsilon);
+		if (!(vmovemask(valid) & group)) continue;
+		// compare against the scaled determinant, as Triangle::occluded does
+		vfloat tx = vsub(ox, vloadu(triangles.ax + base)), ty = vsub(oy, vloadu(triangles.ay + base)), tz = vsub(oz, vloadu(triangles.az + base));
+		vfloat u = vadd(vadd(vmul(tx, px), vmul(ty, py)), vmul(tz, pz));
+		valid = vand(valid, vand(vcmpge(u, zero), vcmple(u, det)));
+		vfloat qx = vsub(vmul(ty, abz), vmul(tz, aby));
+		vfloat qy = vsub(vmul(tz, abx), vmul(tx, abz));
+		vfloat qz = vsub(vmul(tx, aby), vmul(ty, abx));
+		vfloat v = vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz));
+		valid = vand(valid, vand(vcmpge(v, zero), vcmple(vadd(u, v), det)));
+		vfloat thit = vadd(vadd(vmul(acx, qx), vmul(acy, qy)), vmul(acz, qz));
+		valid = vand(valid, vand(vcmpge(thit, zero), vcmplt(thit, vmul(limit, det))));
+		if (vmovemask(valid) & group) return true;
+	}
+	return false;
+}
+
+// Convert count floats of a linear image to 8-bit: each is multiplied by scale, passed
+// through x / (1 + x) if reinhard, clamped to 0..1 and quantised to trunc(x * quantise + offset),
+// which is then looked up in lut if there is one (so without one, codes must fit in a
+// byte). The channels of a pixel all get the same
+// treatment, so RGB floats are converted kWidth at a time without being split up.
+RT_KERNEL void tonemap(const float* in, unsigned char* out, unsigned count, float scale, bool reinhard,
+	float quantise, float offset, const unsigned char* lut)
+{
+	vfloat vscale = vset1(scale), vquantise = vset1(quantise), voffset = vset1(offset);
+	vfloat zero = vset1(0), one = vset1(1);
+	alignas(32) int codes[kWidth];
+	unsigned i = 0;
+	for (; i + kWidth <= count; i += kWidth) {
+		vfloat x = vmax(vmul(vloadu(in + i), vscale), zero);
+		if (reinhard) x = vdiv(x, vadd(x, one));
+		vfloat code = vadd(vmul(vmin(x, one), vquantise), voffset);
+		if (lut) {
+			vstoretrunc(codes, code);
+			for (unsigned j = 0; j < kWidth; ++j) out[i + j] = lut[codes[j]];
+		}
+		else vstorebytes(out + i, code);
+	}
+	// The scalar min and max map NaN to 0 and 1 like the SIMD ones, so the code stays in range
+	for (; i < count; ++i) {
+		float x = scalar::vmax(in[i] * scale, 0.0f);
+		if (reinhard) x = x / (x + 1);
+		int code = int(scalar::vmin(x, 1.0f) * quantise + offset);
+		out[i] = (unsigned char)(lut ? lut[code] : code);
+	}
+}
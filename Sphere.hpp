@@ -1,6 +1,8 @@
 #pragma once
 #include "Vec3.hpp"
 #include "Material.hpp"
+#include "SIMD.hpp"
+#include "CompiledScene.hpp"
 
 class Sphere : public SceneObject
 {
@@ -26,6 +28,11 @@ public:
 		material = mat;
 	}
 
+	AABB bounds() const
+	{
+		return AABB(center - Vec3f(radius), center + Vec3f(radius));
+	}
+
 	//Compute a ray - sphere intersection using the geometric solution
 	bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &t0, float &t1, float &v) const
 	{
@@ -40,4 +47,23 @@ public:
 
 		return true;
 	}
+
+	bool occluded(const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const
+	{
+		Vec3f l = center - rayorig;
+		float tca = l.dot(raydir);
+		if (tca < 0) return false;
+		float d2 = l.dot(l) - tca * tca;
+		if (d2 > radius2) return false;
+		// the near hit is only behind the origin if the origin is inside the sphere
+		float thc = sqrt(radius2 - d2);
+		float t = tca - thc;
+		if (t < 0) t = tca + thc;
+		return t < tmax;
+	}
+
+	void compile(CompiledScene &compiled) const
+	{
+		compiled.addSphere(center, radius2, compiled.addMaterial(surfaceColor, emissionColor, transparency, reflection), this);
+	}
 };
\ No newline at end of file
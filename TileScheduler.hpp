@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Rectangle of pixels from (x0, y0) up to but not including (x1, y1)
+struct Tile
+{
+	unsigned x0, y0, x1, y1;
+};
+
+// Renders frames as sets of tiles on a fixed group of worker threads. Every worker has its
+// own deque of tiles: it takes from the front of its own and, once that is empty, steals
+// from the back of the others', so workers only contend near the end of a frame. run() is
+// the frame barrier and returns once every tile of the frame has been rendered.
+class TileScheduler
+{
+public:
+	typedef std::function<void(const Tile &tile, unsigned worker)> TileFunction;
+
+	// 0 threads uses one per hardware thread
+	explicit TileScheduler(unsigned threads = 0) : generation(0), remaining(0), stopping(false)
+	{
+		if (threads == 0) threads = std::thread::hardware_concurrency();
+		if (threads == 0) threads = 1;
+		for (unsigned i = 0; i < threads; ++i)
+			queues.emplace_back(new WorkerQueue());
+		for (unsigned i = 0; i < threads; ++i)
+			workers.emplace_back(&TileScheduler::workerLoop, this, i);
+	}
+
+	~TileScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	unsigned size() const { return (unsigned)workers.size(); }
+
+	// Render every tile with work and wait for all of them. Tiles are dealt to the workers
+	// in turn, so the ones early in the list are started first.
+	void run(const std::vector<Tile> &tiles, const TileFunction &work)
+	{
+		if (tiles.empty()) return;
+
+		current = &work;
+		remaining = (unsigned)tiles.size();
+		for (unsigned i = 0; i < queues.size(); ++i) {
+			std::lock_guard<std::mutex> lock(queues[i]->mutex);
+			for (unsigned t = i; t < tiles.size(); t += (unsigned)queues.size())
+				queues[i]->tiles.push_back(tiles[t]);
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		generation++;
+		wake.notify_all();
+		done.wait(lock, [&] { return remaining.load() == 0; });
+		current = NULL;
+	}
+
+private:
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Tile> tiles;
+	};
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::thread> workers;
+	const TileFunction* current = NULL;     /// work of the frame being rendered
+	std::mutex mutex;                       /// guards generation and stopping, used by wake and done
+	std::condition_variable wake, done;
+	unsigned generation;                    /// incremented when a frame's tiles are ready
+	std::atomic<unsigned> remaining;        /// tiles of the current frame not yet finished
+	bool stopping;
+
+	bool take(unsigned worker, Tile &tile)
+	{
+		{
+			WorkerQueue &own = *queues[worker];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tiles.empty()) {
+				tile = own.tiles.front();
+				own.tiles.pop_front();
+				return true;
+			}
+		}
+		for (unsigned i = 1; i < queues.size(); ++i) {
+			WorkerQueue &victim = *queues[(worker + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tiles.empty()) {
+				tile = victim.tiles.back();
+				victim.tiles.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void workerLoop(unsigned worker)
+	{
+		unsigned seen = 0;
+		while (true) {
+			Tile tile;
+			if (take(worker, tile)) {
+				(*current)(tile, worker);
+				if (--remaining == 0) {
+					std::lock_guard<std::mutex> lock(mutex);
+					done.notify_all();
+				}
+				continue;
+			}
+
+			// Nothing left to take, sleep until the next frame's tiles are queued
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+		}
+	}
+
+	TileScheduler(const TileScheduler &);
+	TileScheduler & operator=(const TileScheduler &);
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <cmath>
+#include "Vec3.hpp"
+#include "SIMD.hpp"
+
+enum ToneCurve
+{
+	kToneClamp,                             /// values above 1 are clipped
+	kToneReinhard                           /// x / (1 + x), bright values roll off towards 1
+};
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "images are converted as flat arrays of floats");
+
+// How the linear float image is turned into the 8-bit RGB that is shown and saved as .ppm.
+// Tracing only ever writes the float image, and the conversion runs afterwards over whole
+// rows with the SIMD kernels: exposure, then the tone curve, then sRGB encoding through a
+// table indexed by the quantised linear value, since the encoding's power curve is too
+// slow to evaluate per channel. Without sRGB the linear value is clamped and scaled to 255
+// directly.
+class Tonemap
+{
+public:
+	static const unsigned kLutSize = 4096;  /// sRGB table entries over linear 0 to 1
+
+	const float exposure;                   /// stops to brighten (or darken, if negative) the image by
+	const ToneCurve curve;
+	const bool srgb;
+
+	Tonemap(float exposure = 0, ToneCurve curve = kToneClamp, bool srgb = true)
+		: exposure(exposure), curve(curve), srgb(srgb), scale(std::pow(2.0f, exposure))
+	{
+		for (unsigned i = 0; i < kLutSize; ++i) {
+			float linear = float(i) / (kLutSize - 1);
+			float encoded = linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow(linear, 1 / 2.4f) - 0.055f;
+			lut[i] = (unsigned char)(encoded * 255 + 0.5f);
+		}
+	}
+
+	// Convert count pixels of image to 8-bit RGB
+	void apply(const Vec3f* image, char* pixels, unsigned count) const
+	{
+		if (srgb) {
+			simdKernels().tonemap(&image->x, (unsigned char*)pixels, count * 3, scale, curve == kToneReinhard,
+				float(kLutSize - 1), 0.5f, lut);
+		}
+		else {
+			simdKernels().tonemap(&image->x, (unsigned char*)pixels, count * 3, scale, curve == kToneReinhard,
+				255, 0, NULL);
+		}
+	}
+
+	static const char* name(ToneCurve curve)
+	{
+		static const char* names[] = { "clamp", "reinhard" };
+		return names[curve];
+	}
+
+private:
+	float scale;                            /// 2 to the power of exposure
+	unsigned char lut[kLutSize];
+};
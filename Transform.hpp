@@ -0,0 +1,117 @@
+#pragma once
+#include <cmath>
+#include "Vec3.hpp"
+#include "AABB.hpp"
+
+#if !defined(M_PI)
+#define M_PI 3.141592653589793
+#endif
+
+// Affine transform stored as the top three rows of a 4x4 matrix, applied to column vectors
+class Transform
+{
+public:
+	float m[3][4];
+
+	Transform()
+	{
+		for (unsigned r = 0; r < 3; ++r)
+			for (unsigned c = 0; c < 4; ++c) m[r][c] = r == c ? 1.0f : 0.0f;
+	}
+
+	static Transform translate(const Vec3f &offset)
+	{
+		Transform t;
+		t.m[0][3] = offset.x, t.m[1][3] = offset.y, t.m[2][3] = offset.z;
+		return t;
+	}
+
+	static Transform scale(const Vec3f &factors)
+	{
+		Transform t;
+		t.m[0][0] = factors.x, t.m[1][1] = factors.y, t.m[2][2] = factors.z;
+		return t;
+	}
+
+	// Rotation about an axis through the origin, counter-clockwise looking down the axis
+	static Transform rotate(Vec3f axis, float degrees)
+	{
+		axis.normalize();
+		float radians = degrees * float(M_PI) / 180, c = cos(radians), s = sin(radians), k = 1 - c;
+		Transform t;
+		t.m[0][0] = c + axis.x * axis.x * k, t.m[0][1] = axis.x * axis.y * k - axis.z * s, t.m[0][2] = axis.x * axis.z * k + axis.y * s;
+		t.m[1][0] = axis.y * axis.x * k + axis.z * s, t.m[1][1] = c + axis.y * axis.y * k, t.m[1][2] = axis.y * axis.z * k - axis.x * s;
+		t.m[2][0] = axis.z * axis.x * k - axis.y * s, t.m[2][1] = axis.z * axis.y * k + axis.x * s, t.m[2][2] = c + axis.z * axis.z * k;
+		return t;
+	}
+
+	// This transform applied after other
+	Transform operator * (const Transform &other) const
+	{
+		Transform t;
+		for (unsigned r = 0; r < 3; ++r) {
+			for (unsigned c = 0; c < 4; ++c) {
+				t.m[r][c] = m[r][0] * other.m[0][c] + m[r][1] * other.m[1][c] + m[r][2] * other.m[2][c] + (c == 3 ? m[r][3] : 0);
+			}
+		}
+		return t;
+	}
+
+	Transform inverse() const
+	{
+		// Inverse of the 3x3 part from its cofactors, then the translation moved back through it
+		float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+		float invdet = det != 0 ? 1 / det : 0;
+		Transform t;
+		t.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invdet;
+		t.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invdet;
+		t.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invdet;
+		t.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invdet;
+		t.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invdet;
+		t.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invdet;
+		t.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invdet;
+		t.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invdet;
+		t.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invdet;
+		Vec3f offset = t.vector(Vec3f(m[0][3], m[1][3], m[2][3]));
+		t.m[0][3] = -offset.x, t.m[1][3] = -offset.y, t.m[2][3] = -offset.z;
+		return t;
+	}
+
+	Vec3f point(const Vec3f &p) const
+	{
+		return Vec3f(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+			m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+			m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+	}
+
+	// Directions are not translated and keep the length the transform gives them
+	Vec3f vector(const Vec3f &v) const
+	{
+		return Vec3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+			m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+			m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+	}
+
+	// Multiply by the transpose of the 3x3 part. Normals are carried from object to world
+	// space by the transpose of the world to object transform.
+	Vec3f transposedVector(const Vec3f &v) const
+	{
+		return Vec3f(m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+			m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+			m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z);
+	}
+
+	// Box around the transformed corners of box
+	AABB bounds(const AABB &box) const
+	{
+		AABB result;
+		if (!box.valid()) return result;
+		for (unsigned corner = 0; corner < 8; ++corner) {
+			result.expand(point(Vec3f(corner & 1 ? box.bmax.x : box.bmin.x,
+				corner & 2 ? box.bmax.y : box.bmin.y, corner & 4 ? box.bmax.z : box.bmin.z)));
+		}
+		return result;
+	}
+};
@@ -1,13 +1,15 @@
 #pragma once
 #include "Vec3.hpp"
 #include "Material.hpp"
-
-constexpr float kEpsilon = 1e-8;
+#include "SIMD.hpp"
+#include "CompiledScene.hpp"
 
 class Triangle : public SceneObject
 {
 public:
 	Vec3f a, b, c;							/// position of the triangle vertices
+	Vec3f ab, ac;							/// edges from a, precomputed for the intersection tests
+	Vec3f normal;							/// unit geometric normal, ab x ac
 	Triangle(
 		const Vec3f &a,
 		const Vec3f &b,
@@ -26,12 +28,23 @@ public:
 		transparency = transp;
 		reflection = refl;
 		material = mat;
+		ab = b - a;
+		ac = c - a;
+		normal = ab.crossProduct(ac).normalize();
+		center = (a + b + c) * (1.0f / 3);
+	}
+	AABB bounds() const
+	{
+		AABB box;
+		box.expand(a);
+		box.expand(b);
+		box.expand(c);
+		return box;
 	}
+
 	//Compute a ray - sphere intersection using the geometric solution
 	bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &t, float &u, float &v)  const
 	{
-		Vec3f ab = b - a;
-		Vec3f ac = c - a;
 		Vec3f pvec = raydir.crossProduct(ac);
 		float det = ab.dot(pvec);
 
@@ -57,9 +70,32 @@ public:
 		if (v < 0 || (u + v)>1) return false;
 
 		t = ac.dot(qvec)*invDet;
+		if (t < 0) return false;
 
 		/*std::cout << t << std::endl;*/
 
 		return true;
 	}
+
+	bool occluded(const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const
+	{
+		Vec3f pvec = raydir.crossProduct(ac);
+		float det = ab.dot(pvec);
+		if (det < kEpsilon) return false;
+
+		// compare against the scaled determinant to avoid the division until we know we hit
+		Vec3f tvec = rayorig - a;
+		float u = tvec.dot(pvec);
+		if (u < 0 || u > det) return false;
+		Vec3f qvec = tvec.crossProduct(ab);
+		float v = raydir.dot(qvec);
+		if (v < 0 || u + v > det) return false;
+		float t = ac.dot(qvec);
+		return t >= 0 && t < tmax * det;
+	}
+
+	void compile(CompiledScene &compiled) const
+	{
+		compiled.addTriangle(a, b, c, compiled.addMaterial(surfaceColor, emissionColor, transparency, reflection), this);
+	}
 };
\ No newline at end of file
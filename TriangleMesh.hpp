@@ -0,0 +1,106 @@
+#pragma once
+#include <limits>
+#include <vector>
+#include "Vec3.hpp"
+#include "Material.hpp"
+#include "SceneObject.hpp"
+#include "SIMD.hpp"
+#include "CompiledScene.hpp"
+
+// Triangles sharing one vertex buffer and one material. Each vertex is stored once however
+// many triangles use it, so a mesh is loaded in 12 bytes per vertex and 12 per triangle
+// rather than a Triangle object per face. Compiling it expands every face into the
+// CompiledScene triangle arrays, about 60 bytes per triangle with its source, after which
+// the scene releases the buffers of any mesh that is not a light, leaving only those.
+// Call update() after changing the buffers.
+class TriangleMesh : public SceneObject
+{
+public:
+	std::vector<Vec3f> vertices;
+	std::vector<unsigned> indices;          /// three vertex indices per triangle, counter-clockwise seen from the front
+
+	TriangleMesh(
+		const Vec3f &sc,
+		const float &refl = 0,
+		const float &transp = 1.0,
+		const Vec3f &ec = 0,
+		const Material &mat = Material())
+	{
+		surfaceColor = sc;
+		emissionColor = ec;
+		transparency = transp;
+		reflection = refl;
+		material = mat;
+	}
+
+	unsigned triangleCount() const { return (unsigned)indices.size() / 3; }
+
+	// Recompute the bounds and centre from the vertices
+	void update()
+	{
+		box = AABB();
+		for (unsigned i = 0; i < vertices.size(); ++i)
+			box.expand(vertices[i]);
+		center = box.valid() ? box.centroid() : Vec3f(0);
+	}
+
+	AABB bounds() const { return box; }
+
+	// Closest front facing hit over every triangle. Rays are traced against the compiled
+	// scene, so this is only used when the mesh is a light.
+	bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &t, float &u, float &v) const
+	{
+		t = std::numeric_limits<float>::max();
+		bool hit = false;
+		for (unsigned i = 0; i < triangleCount(); ++i) {
+			float tt, uu, vv;
+			if (intersectTriangle(i, rayorig, raydir, tt, uu, vv) && tt < t) t = tt, u = uu, v = vv, hit = true;
+		}
+		return hit;
+	}
+
+	bool occluded(const Vec3f &rayorig, const Vec3f &raydir, const float &tmax) const
+	{
+		for (unsigned i = 0; i < triangleCount(); ++i) {
+			float t, u, v;
+			if (intersectTriangle(i, rayorig, raydir, t, u, v) && t < tmax) return true;
+		}
+		return false;
+	}
+
+	void compile(CompiledScene &compiled) const
+	{
+		unsigned id = compiled.addMaterial(surfaceColor, emissionColor, transparency, reflection);
+		for (unsigned i = 0; i + 2 < indices.size(); i += 3)
+			compiled.addTriangle(vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]], id, this);
+	}
+
+	// Free the vertex and index buffers of a compiled mesh. Its triangles live on in the
+	// compiled scene and bounds() still holds, but it cannot be compiled or hit again.
+	void release()
+	{
+		std::vector<Vec3f>().swap(vertices);
+		std::vector<unsigned>().swap(indices);
+	}
+
+private:
+	AABB box;
+
+	bool intersectTriangle(unsigned i, const Vec3f &rayorig, const Vec3f &raydir, float &t, float &u, float &v) const
+	{
+		const Vec3f &a = vertices[indices[3 * i]];
+		Vec3f ab = vertices[indices[3 * i + 1]] - a, ac = vertices[indices[3 * i + 2]] - a;
+		Vec3f pvec = raydir.crossProduct(ac);
+		float det = ab.dot(pvec);
+		if (det < kEpsilon) return false;
+		float invDet = 1 / det;
+		Vec3f tvec = rayorig - a;
+		u = tvec.dot(pvec) * invDet;
+		if (u < 0 || u > 1) return false;
+		Vec3f qvec = tvec.crossProduct(ab);
+		v = raydir.dot(qvec) * invDet;
+		if (v < 0 || u + v > 1) return false;
+		t = ac.dot(qvec) * invDet;
+		return t >= 0;
+	}
+};
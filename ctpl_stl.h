@@ -29,6 +29,8 @@
 #include <future>
 #include <mutex>
 #include <queue>
+#include <cstddef>
+#include <cstdint>
 
 
 
@@ -66,14 +68,104 @@ namespace ctpl {
 			std::queue<T> q;
 			std::mutex mutex;
 		};
+
+		// bounded multi-producer multi-consumer queue without locks (D. Vyukov's ring buffer)
+		// every cell carries a sequence number telling producers and consumers whose turn it is
+		template <typename T>
+		class LockFreeQueue {
+		public:
+			// size is rounded up to a power of two
+			explicit LockFreeQueue(size_t size) {
+				size_t capacity = 2;
+				while (capacity < size)
+					capacity *= 2;
+				this->cells.reset(new Cell[capacity]);
+				this->mask = capacity - 1;
+				for (size_t i = 0; i < capacity; ++i)
+					this->cells[i].sequence.store(i, std::memory_order_relaxed);
+				this->enqueuePos.store(0, std::memory_order_relaxed);
+				this->dequeuePos.store(0, std::memory_order_relaxed);
+			}
+			// returns false if the queue is full
+			bool push(T const & value) {
+				Cell * cell;
+				size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+				while (true) {
+					cell = &this->cells[pos & this->mask];
+					size_t seq = cell->sequence.load(std::memory_order_acquire);
+					intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+					if (dif == 0) {
+						if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+							break;
+					}
+					else if (dif < 0)
+						return false;
+					else
+						pos = this->enqueuePos.load(std::memory_order_relaxed);
+				}
+				cell->data = value;
+				cell->sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+			bool pop(T & v) {
+				Cell * cell;
+				size_t pos = this->dequeuePos.load(std::memory_order_relaxed);
+				while (true) {
+					cell = &this->cells[pos & this->mask];
+					size_t seq = cell->sequence.load(std::memory_order_acquire);
+					intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+					if (dif == 0) {
+						if (this->dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+							break;
+					}
+					else if (dif < 0)
+						return false;
+					else
+						pos = this->dequeuePos.load(std::memory_order_relaxed);
+				}
+				v = cell->data;
+				cell->sequence.store(pos + this->mask + 1, std::memory_order_release);
+				return true;
+			}
+			bool empty() {
+				return this->enqueuePos.load(std::memory_order_acquire) == this->dequeuePos.load(std::memory_order_acquire);
+			}
+		private:
+			struct Cell {
+				std::atomic<size_t> sequence;
+				T data;
+			};
+			// padding keeps the producer and consumer positions on separate cache lines
+			char pad0[64];
+			std::unique_ptr<Cell[]> cells;
+			size_t mask;
+			char pad1[64];
+			std::atomic<size_t> enqueuePos;
+			char pad2[64];
+			std::atomic<size_t> dequeuePos;
+			char pad3[64];
+		};
 	}
 
+	// how queued functions are stored, see thread_pool(int, queue_type, int)
+	enum class queue_type {
+		locked,     // std::queue guarded by a mutex, unbounded
+		lock_free   // bounded lock free ring, push waits while it is full
+	};
+
 	class thread_pool {
 
 	public:
 
 		thread_pool() { this->init(); }
 		thread_pool(int nThreads) { this->init(); this->resize(nThreads); }
+		// queueSize is only used by the lock free queue, which cannot grow
+		thread_pool(int nThreads, queue_type type, int queueSize = 4096) {
+			this->init();
+			if (type == queue_type::lock_free)
+				this->lfq.reset(new detail::LockFreeQueue<std::function<void(int id)> *>(queueSize));
+			this->resize(nThreads);
+		}
 
 		// the destructor waits for all the functions in the queue to be finished
 		~thread_pool() {
@@ -87,6 +179,12 @@ namespace ctpl {
 		int n_idle() { return this->nWaiting; }
 		int n_pending() { return this->nPending; }
 		std::thread & get_thread(int i) { return *this->threads[i]; }
+		bool is_lock_free() { return this->lfq != nullptr; }
+
+		// how many times an idle thread polls the queue, yielding in between, before it sleeps
+		// on the condition variable. spinning saves the wake-up when tasks are short and
+		// frequent, 0 sleeps straight away
+		void set_spin_count(int count) { this->spinCount = count; }
 
 		// change the number of threads in the pool
 		// should be called from one thread, otherwise be careful to not interleave, also with this->stop()
@@ -122,14 +220,14 @@ namespace ctpl {
 		// empty the queue
 		void clear_queue() {
 			std::function<void(int id)> * _f;
-			while (this->q.pop(_f))
+			while (this->pop_task(_f))
 				delete _f; // empty the queue
 		}
 
 		// pops a functional wrapper to the original function
 		std::function<void(int)> pop() {
 			std::function<void(int id)> * _f = nullptr;
-			this->q.pop(_f);
+			this->pop_task(_f);
 			std::unique_ptr<std::function<void(int id)>> func(_f); // at return, delete the function even if an exception occurred
 			std::function<void(int)> f;
 			if (_f)
@@ -179,9 +277,7 @@ namespace ctpl {
 				(*pck)(id);
 			});
 			++this->nPending;
-			this->q.push(_f);
-			std::unique_lock<std::mutex> lock(this->mutex);
-			this->cv.notify_one();
+			this->push_task(_f);
 			return pck->get_future();
 		}
 
@@ -194,9 +290,7 @@ namespace ctpl {
 				(*pck)(id);
 			});
 			++this->nPending;
-			this->q.push(_f);
-			std::unique_lock<std::mutex> lock(this->mutex);
-			this->cv.notify_one();
+			this->push_task(_f);
 			return pck->get_future();
 		}
 
@@ -209,12 +303,34 @@ namespace ctpl {
 		thread_pool & operator=(const thread_pool &);// = delete;
 		thread_pool & operator=(thread_pool &&);// = delete;
 
+		// queue a task and wake a sleeping thread, if there is one
+		void push_task(std::function<void(int id)> * _f) {
+			if (this->lfq) {
+				while (!this->lfq->push(_f))
+					std::this_thread::yield();  // full, wait for the threads to take some tasks
+			}
+			else
+				this->q.push(_f);
+			// a thread going to sleep counts itself before checking the queue, so either it sees
+			// this task or we see it waiting. spinning threads will find the task themselves.
+			// ThreadSanitizer does not model fences, so it can't check this hand-off
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (this->nWaiting > 0) {
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->cv.notify_one();
+			}
+		}
+
+		bool pop_task(std::function<void(int id)> * & _f) {
+			return this->lfq ? this->lfq->pop(_f) : this->q.pop(_f);
+		}
+
 		void set_thread(int i) {
 			std::shared_ptr<std::atomic<bool>> flag(this->flags[i]); // a copy of the shared ptr to the flag
 			auto f = [this, i, flag/* a copy of the shared ptr to the flag */]() {
 				std::atomic<bool> & _flag = *flag;
 				std::function<void(int id)> * _f;
-				bool isPop = this->q.pop(_f);
+				bool isPop = this->pop_task(_f);
 				while (true) {
 					while (isPop) {  // if there is anything in the queue
 						--this->nPending;
@@ -223,12 +339,19 @@ namespace ctpl {
 						if (_flag)
 							return;  // the thread is wanted to stop, return even if the queue is not empty yet
 						else
-							isPop = this->q.pop(_f);
+							isPop = this->pop_task(_f);
+					}
+					// the queue is empty here, poll it for a while before going to sleep
+					for (int spin = 0; spin < this->spinCount && !isPop && !this->isDone && !_flag; ++spin) {
+						std::this_thread::yield();
+						isPop = this->pop_task(_f);
 					}
-					// the queue is empty here, wait for the next command
+					if (isPop)
+						continue;
+					// wait for the next command
 					std::unique_lock<std::mutex> lock(this->mutex);
 					++this->nWaiting;
-					this->cv.wait(lock, [this, &_f, &isPop, &_flag]() { isPop = this->q.pop(_f); return isPop || this->isDone || _flag; });
+					this->cv.wait(lock, [this, &_f, &isPop, &_flag]() { isPop = this->pop_task(_f); return isPop || this->isDone || _flag; });
 					--this->nWaiting;
 					if (!isPop)
 						return;  // if the queue is empty and this->isDone == true or *flag then return
@@ -237,11 +360,13 @@ namespace ctpl {
 			this->threads[i].reset(new std::thread(f)); // compiler may not support std::make_unique()
 		}
 
-		void init() { this->nWaiting = 0; this->nPending = 0; this->isStop = false; this->isDone = false; }
+		void init() { this->nWaiting = 0; this->nPending = 0; this->isStop = false; this->isDone = false; this->spinCount = 0; }
 
 		std::vector<std::unique_ptr<std::thread>> threads;
 		std::vector<std::shared_ptr<std::atomic<bool>>> flags;
 		detail::Queue<std::function<void(int id)> *> q;
+		std::unique_ptr<detail::LockFreeQueue<std::function<void(int id)> *>> lfq;  // used instead of q when set
+		std::atomic<int> spinCount;
 		std::atomic<bool> isDone;
 		std::atomic<bool> isStop;
 		std::atomic<int> nWaiting;  // how many threads are waiting